@@ -1,8 +1,22 @@
 #include "GUIRenderer.h"
+#include <algorithm>
+#include <chrono>
 
 GUIRenderer::GUIRenderer(int screenWidth, int screenHeight) {
     this->screenWidth = screenWidth;
     this->screenHeight = screenHeight;
+    guiInitialized = false;
+    // the render thread creates the window and reports whether it succeeded
+    renderThread = std::thread(&GUIRenderer::renderLoop, this);
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return initDone; });
+}
+
+GUIRenderer::~GUIRenderer() {
+    quit();
+}
+
+void GUIRenderer::initialize() {
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         cout << "SDL could not be initialized!" << endl << "SDL_Error: " << SDL_GetError() << endl;
         guiInitialized = false;
@@ -33,6 +47,7 @@ GUIRenderer::GUIRenderer(int screenWidth, int screenHeight) {
             cout << "Renderer could not be created!" << endl
                  << "SDL_Error: " << SDL_GetError() << endl;
             SDL_DestroyWindow(window);
+            window = nullptr;
             guiInitialized = false;
             return;
         }
@@ -40,72 +55,142 @@ GUIRenderer::GUIRenderer(int screenWidth, int screenHeight) {
     guiInitialized = true;
 }
 
-int GUIRenderer::displayRect(int screenWidth, int screenHeight) {
-    // Declare rect of square
-    SDL_Rect squareRect;
-
-    // Square dimensions: Half of the min(SCREEN_WIDTH, SCREEN_HEIGHT)
-    squareRect.w = std::min(screenWidth, screenHeight) / 2;
-    squareRect.w = 10;
-    squareRect.h = std::min(screenWidth, screenHeight) / 2;
-    squareRect.h = 10;
+// Body of the render thread: draws what the other threads hand over and reacts to the window events.
+// Pressing the mouse button shows the image alone, releasing it shows the clusters overlay again.
+void GUIRenderer::renderLoop() {
+    initialize();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        initDone = true;
+    }
+    changed.notify_all();
+    if (!guiInitialized)
+        return;
 
-    // Square position: In the middle of the screen
-    squareRect.x = screenWidth / 2 - squareRect.w / 2;
-    squareRect.y = screenHeight / 2 - squareRect.h / 2;
+    SDL_Event e;
+    while (true) {
+        bool dirty = false;
+        while (SDL_PollEvent(&e)) {
+            if (e.type == SDL_QUIT) {
+                std::lock_guard<std::mutex> lock(mutex);
+                closed = true;
+                changed.notify_all();
+            } else if (e.type == SDL_MOUSEBUTTONDOWN) {
+                showOverlay = false;
+                dirty = true;
+            } else if (e.type == SDL_MOUSEBUTTONUP) {
+                showOverlay = true;
+                dirty = true;
+            } else if (e.type == SDL_WINDOWEVENT) {
+                dirty = true;
+            }
+        }
+        if (updateTextures() || dirty)
+            redraw();
 
-    // Initialize renderer color white for the background
-    SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);
-    // Clear screen
-    SDL_RenderClear(renderer);
-    // Set renderer color red to draw the square
-    SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0x00, 0xFF);
-    // Draw filled square
-    SDL_RenderFillRect(renderer, &squareRect);
-    // Update screen
-    SDL_RenderPresent(renderer);
-    return 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        if (stopRequested)
+            break;
+        changed.wait_for(lock, std::chrono::milliseconds(10), [this] {
+            return stopRequested || imagePending || palettePending || overlayPending;
+        });
+    }
+    destroy();
 }
 
-// Locks a surface
-void GUIRenderer::lockSurface(SDL_Surface *srf) {
-    if (SDL_MUSTLOCK(srf))
-        if (SDL_LockSurface(srf) < 0)
-            return;
-}
+// Move the data handed over by the other threads into the textures. Returns true when something changed.
+bool GUIRenderer::updateTextures() {
+    std::vector<Uint8> image;
+    std::vector<SDL_Color> palette;
+    int width = 0, height = 0;
+    bool newLabels = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (imagePending) {
+            image.swap(pendingImage);
+            width = pendingWidth, height = pendingHeight;
+            imagePending = false;
+        }
+        if (palettePending) {
+            palette.swap(pendingPalette);
+            palettePending = false;
+        }
+        if (overlayPending) {
+            renderLabels.swap(pendingLabels);
+            overlayPending = false;
+            newLabels = true;
+        }
+    }
 
-// Unlocks a surface
-void GUIRenderer::unlockSurface(SDL_Surface *srf) {
-    if (SDL_MUSTLOCK(srf))
-        SDL_UnlockSurface(srf);
-}
+    if (!image.empty()) {
+        if (imageTexture != nullptr) SDL_DestroyTexture(imageTexture);
+        if (overlayTexture != nullptr) SDL_DestroyTexture(overlayTexture);
+        imageWidth = width, imageHeight = height;
+        imageTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STATIC, width, height);
+        SDL_UpdateTexture(imageTexture, nullptr, image.data(), width * 3);
+        overlayTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+        SDL_SetTextureBlendMode(overlayTexture, SDL_BLENDMODE_BLEND);
+        overlayReady = false;
 
-void GUIRenderer::setPixelSurface(SDL_Surface* srf, int x, int y, SDL_Color color) {
-    if (x < 0 || y < 0 || x >= srf->w || y >= srf->h) return;
-    SDL_PixelFormat *fmt = srf->format;
-    Uint32 colorSDL = SDL_MapRGBA(fmt, color.r, color.g, color.b, color.a);
-    Uint32* bufp = (Uint32*)srf->pixels + y * srf->pitch / 4 + x;
-    *bufp = colorSDL;
+        // scale to the window
+        int maxWidth, maxHeight;
+        SDL_GetWindowSize(window, &maxWidth, &maxHeight);
+        drawWidth = std::min(width, maxWidth);
+        drawHeight = std::min(height, maxHeight);
+        SDL_SetWindowSize(window, drawWidth, drawHeight);
+    }
+    if (!palette.empty()) {
+        SDL_PixelFormat *format = SDL_AllocFormat(SDL_PIXELFORMAT_ARGB8888);
+        paletteLUT.resize(palette.size());
+        for (size_t i = 0; i < palette.size(); i++)
+            paletteLUT[i] = SDL_MapRGBA(format, palette[i].r, palette[i].g, palette[i].b, palette[i].a);
+        SDL_FreeFormat(format);
+    }
+    if (newLabels)
+        fillOverlay(renderLabels.data());
+    return !image.empty() || newLabels;
 }
 
-// Update the screen.  Has to be called to view new pixels.
-void GUIRenderer::redrawTexture(SDL_Texture *tex, SDL_Surface* srf, bool freeSurface) {
-    SDL_UpdateTexture(tex, NULL, srf->pixels, srf->pitch);
-    if(freeSurface) SDL_FreeSurface(srf);
-    //    SDL_RenderClear(renderer);
-    SDL_Rect dest_rect = {0, 0, srf->w, srf->h};
-    SDL_RenderCopy(renderer, tex, nullptr, &dest_rect);
-    SDL_RenderPresent(renderer);
+// Convert the cluster map into the overlay texture through the palette lookup table. The rows are filled by the
+// render thread alone, vectorised, so that the GUI does not compete for the cores of the k-means team.
+void GUIRenderer::fillOverlay(const int *labels) {
+    if (overlayTexture == nullptr || paletteLUT.empty() || renderLabels.size() != (size_t) imageWidth * imageHeight)
+        return;
+    void *pixels;
+    int pitch, row;
+    if (SDL_LockTexture(overlayTexture, nullptr, &pixels, &pitch) < 0)
+        return;
+    const Uint32 *lut = paletteLUT.data();
+    int width = imageWidth;
+    for (row = 0; row < imageHeight; row++) {
+        Uint32 *dest = (Uint32 *) ((Uint8 *) pixels + (long) row * pitch);
+        const int *src = labels + (long) row * width;
+#ifdef _OPENMP
+        #pragma omp simd
+#endif
+        for (int x = 0; x < width; x++)
+            dest[x] = lut[src[x]];
+    }
+    SDL_UnlockTexture(overlayTexture);
+    overlayReady = true;
 }
 
-// Clears the screen with color parameter
-void GUIRenderer::clearScreen(const SDL_Color color) {
-    SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+// Draw the image and, if enabled, the clusters overlay blended over it
+void GUIRenderer::redraw() {
+    if (imageTexture == nullptr)
+        return;
+    SDL_Rect dest_rect = {0, 0, drawWidth, drawHeight};
+    SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xFF);
     SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, imageTexture, nullptr, &dest_rect);
+    if (showOverlay && overlayReady)
+        SDL_RenderCopy(renderer, overlayTexture, nullptr, &dest_rect);
     SDL_RenderPresent(renderer);
 }
 
-void GUIRenderer::quit() {
+void GUIRenderer::destroy() {
+    if (overlayTexture != nullptr) SDL_DestroyTexture(overlayTexture);
+    if (imageTexture != nullptr) SDL_DestroyTexture(imageTexture);
     // Destroy renderer
     SDL_DestroyRenderer(renderer);
     // Destroy window
@@ -114,22 +199,45 @@ void GUIRenderer::quit() {
     SDL_Quit();
 }
 
-SDL_Texture* GUIRenderer::renderSurface(SDL_Surface *sdlSurface, bool freeSurface, int width_size, int height_size) {
-    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, sdlSurface);
-    if(freeSurface) SDL_FreeSurface(sdlSurface);
-    if(width_size<0 || height_size<0){
-        width_size = sdlSurface->w;
-        height_size = sdlSurface->h;
+// Show the RGB24 image under the overlays
+void GUIRenderer::setImage(const Uint8 *rgb, int width, int height) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pendingImage.assign(rgb, rgb + (long) width * height * 3);
+    pendingWidth = width, pendingHeight = height;
+    imagePending = true;
+    changed.notify_all();
+}
+
+// Set the colours of the clusters, the alpha channel gives the blending over the image
+void GUIRenderer::setPalette(const SDL_Color *colors, int numColors) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pendingPalette.assign(colors, colors + numColors);
+    palettePending = true;
+    changed.notify_all();
+}
+
+// Hand over a snapshot of the cluster map. The copy is made before taking the lock, so the caller never waits
+// for the render thread; a snapshot not drawn yet is replaced.
+void GUIRenderer::submitOverlay(const int *pixelsMap, long numPixels) {
+    submitLabels.assign(pixelsMap, pixelsMap + numPixels);
+    std::lock_guard<std::mutex> lock(mutex);
+    submitLabels.swap(pendingLabels);
+    overlayPending = true;
+    changed.notify_all();
+}
+
+// Wait until the user closes the window
+void GUIRenderer::waitClose() {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return closed || !guiInitialized; });
+}
+
+void GUIRenderer::quit() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopRequested = true;
     }
-    // scale and print
-    int* max_width = new int;
-    int* max_height = new int;
-    SDL_GetWindowSize(window, max_width, max_height);
-    if(width_size>*max_width) width_size=*max_width;
-    if(height_size>*max_height) height_size=*max_height;
-    SDL_Rect dest_rect = {0, 0, width_size, height_size};
-    SDL_SetWindowSize(window, width_size, height_size);
-    SDL_RenderCopy(renderer, texture, nullptr, &dest_rect);
-    SDL_RenderPresent(renderer);
-    return texture;
+    changed.notify_all();
+    if (renderThread.joinable())
+        renderThread.join();
 }
@@ -1,5 +1,9 @@
 #include <iostream>
 #include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
 #include "SDL.h"
 
 #ifndef GUIRENDERER_H
@@ -7,21 +11,51 @@
 
 using namespace std;
 
+// Window showing the image and the clusters overlay. Every SDL call is made by a dedicated render thread, which
+// owns the window, the renderer and the textures; the other threads only hand over data and never wait for a
+// frame to be drawn. Overlays are submitted as snapshots of the cluster map, a snapshot not drawn yet is replaced
+// by the newer one.
 struct GUIRenderer {
     GUIRenderer(int screenWidth, int screenHeight);
-    int displayRect(int screenWidth, int screenHeight);
-    void lockSurface(SDL_Surface *srf);
-    void unlockSurface(SDL_Surface *srf);
-    void setPixelSurface(SDL_Surface *srf, int x, int y, SDL_Color color);
+    ~GUIRenderer();
+    void setImage(const Uint8 *rgb, int width, int height);
+    void setPalette(const SDL_Color *colors, int numColors);
+    void submitOverlay(const int *pixelsMap, long numPixels);
+    void waitClose();
     void quit();
-    void redrawTexture(SDL_Texture *tex, SDL_Surface* srf, bool freeSurface = false);
-    void clearScreen(SDL_Color color);
-    SDL_Texture* renderSurface(SDL_Surface *sdlSurface, bool freeSurface = false, int width_size = -1, int height_size = -1);
 
-    SDL_Window *window;
-    SDL_Renderer *renderer;
     int screenWidth, screenHeight;
     bool guiInitialized;
+
+private:
+    void renderLoop();
+    void initialize();
+    bool updateTextures();
+    void fillOverlay(const int *labels);
+    void redraw();
+    void destroy();
+
+    SDL_Window *window = nullptr;
+    SDL_Renderer *renderer = nullptr;
+    SDL_Texture *imageTexture = nullptr;
+    // streaming texture rewritten at every overlay
+    SDL_Texture *overlayTexture = nullptr;
+    int imageWidth = 0, imageHeight = 0, drawWidth = 0, drawHeight = 0;
+    bool showOverlay = true, overlayReady = false;
+
+    std::thread renderThread;
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool initDone = false, stopRequested = false, closed = false;
+    // data handed over to the render thread, guarded by mutex
+    bool imagePending = false, palettePending = false, overlayPending = false;
+    std::vector<Uint8> pendingImage;
+    int pendingWidth = 0, pendingHeight = 0;
+    std::vector<SDL_Color> pendingPalette;
+    // triple buffer of cluster map snapshots: filled by the submitter, waiting, being drawn
+    std::vector<int> submitLabels, pendingLabels, renderLabels;
+    // palette mapped to the pixel format of overlayTexture
+    std::vector<Uint32> paletteLUT;
 };
 
 
@@ -1,5 +1,25 @@
 #include "argsParser.h"
 
+// Move args to the next value of option, which must be present
+static char *nextValue(char **&args, const string &option) {
+    if (*(args + 1) == nullptr) {
+        cout << "ERROR: Unexpected command line value: missing value for " << option << endl;
+        throw std::invalid_argument("");
+    }
+    return *++args;
+}
+
+// Move args to the next value of option, which must be an integer
+static int nextInt(char **&args, const string &option) {
+    istringstream value(nextValue(args, option));
+    int number;
+    if (!(value >> number) || !(value >> ws).eof()) {
+        cout << "ERROR: Unexpected command line value: " << option << " requires an integer, found " << *args << endl;
+        throw std::invalid_argument("");
+    }
+    return number;
+}
+
 int ArgsParser::parse(int argc, char **argv) {
     string x;
     char **args = argv + 1;
@@ -24,6 +44,16 @@ int ArgsParser::parse(int argc, char **argv) {
                     cout << "ERROR: Unexpected command line value: number of thread must be > 0]" << endl;
                     throw std::invalid_argument("");
                 }
+            } else if (x == "-kincr") {
+                // Specify to build every k of the search from the model of k-1
+                x = nextValue(args, x);
+                if (x == "split") incrementalMode = INCREMENTAL_SPLIT;
+                else if (x == "pp") incrementalMode = INCREMENTAL_PLUSPLUS;
+                else if (x == "bisect") incrementalMode = INCREMENTAL_BISECT;
+                else {
+                    cout << "ERROR: Unexpected command line value: incremental mode must be one of [split, pp, bisect]" << endl;
+                    throw std::invalid_argument("");
+                }
             } else if (x == "-d") {
                 // Specify number portion of data to use
                 istringstream(*++args) >> dataUsage;
@@ -34,9 +64,53 @@ int ArgsParser::parse(int argc, char **argv) {
             } else if (x == "-i") {
                 // Specify max number of iterations to perform
                 istringstream(*++args) >> maxIterations;
+            } else if (x == "-multires") {
+                // Specify to refine the centroids on growing subsamples before the passes over the whole data
+                multiResPasses = nextInt(args, x);
+                if(multiResPasses < 1){
+                    cout << "ERROR: Unexpected command line value: number of full passes must be > 0" << endl;
+                    throw std::invalid_argument("");
+                }
+            } else if (x == "-tile") {
+                // Specify the side of the tiles used to visit the image during assignment
+                tileSize = nextInt(args, x);
+                if(tileSize < 0){
+                    cout << "ERROR: Unexpected command line value: tileSize must be >= 0" << endl;
+                    throw std::invalid_argument("");
+                }
+            } else if (x == "-kernel") {
+                // Specify the nearest-centroid search used during assignment
+                x = nextValue(args, x);
+                if (x == "brute") assignKernel = KERNEL_BRUTE;
+                else if (x == "partial") assignKernel = KERNEL_PARTIAL;
+                else {
+                    cout << "ERROR: Unexpected command line value: kernel must be one of [brute, partial]" << endl;
+                    throw std::invalid_argument("");
+                }
+            } else if (x == "-bench") {
+                // Compare the assignment kernels at the end of each execution
+                benchmarkKernels = true;
+            } else if (x == "-repro") {
+                // Specify reductions giving the same results for any number of threads
+                reproducible = true;
             } else if (x == "-s") {
                 // Specify the visualization of the results
                 displayClusters = true;
+            } else if (x == "-frames") {
+                // Specify to save the cluster map of every iteration as image files
+                framesPrefix = nextValue(args, x);
+            } else if (x == "-save") {
+                // Specify to save the centroids of every k as a model
+                modelPrefix = nextValue(args, x);
+            } else if (x == "-predict") {
+                // Specify to label a new cube with a saved model instead of clustering
+                predictModel = nextValue(args, x);
+                predictInput = nextValue(args, x);
+                predictOutput = nextValue(args, x);
+                if(predictModel.empty() || predictInput.empty() || predictOutput.empty()){
+                    cout << "ERROR: Unexpected command line value: predict requires model, input and output files" << endl;
+                    throw std::invalid_argument("");
+                }
             } else if (x == "-h") {
                 printHelp(argv[0]);
                 return 1;
@@ -59,14 +133,23 @@ void printHelp(char *arg0) {
     cout << endl << "Performs K-Means clustering for the specified image file." << endl
               << "USAGE:" << endl
               << "    " << arg0 << " "
-              << "[-k numClusters] [-ksearch searchThreads kmeansThreads] [-i maxIterations] [-d dataUsage] [-s] [-o] [-v] [-t]"
+              << "[-k numClusters] [-ksearch searchThreads kmeansThreads] [-kincr mode] [-i maxIterations] [-d dataUsage] [-multires fullPasses] [-tile tileSize] [-kernel name] [-bench] [-repro] [-s] [-frames prefix] [-save prefix] [-predict model input output] [-o] [-v] [-t]"
               << endl
               << "ARGUMENTS:" << endl
               << "    -k\tNumber of clusters to compute (default=10)." << endl
-              << "    -ksearch\tExecute the algorithm over the number of clusters in range [2, k]. Specify the numbers of threads for search and KMeans computation." << endl
+              << "    -ksearch\tExecute the algorithm over the number of clusters in range [2, k], every k stops when less than 0.1% of the pixels change cluster. Specify the numbers of threads for search and KMeans computation." << endl
+              << "    -kincr\tWith -ksearch, build k from the converged k-1 model: split=split the highest-SSE cluster, pp=add a k-means++ sampled centroid, bisect=bisecting k-means." << endl
               << "    -i\tMax number of iterations to perform (default=10)." << endl
               << "    -d\tData usage fraction 0=min, 4=max (default=1)." << endl
+              << "    -multires\tLoad the whole cube and refine the centroids on stratified subsamples growing from the dataUsage fraction to 1/2, then finish with fullPasses iterations on all data." << endl
+              << "    -tile\tVisit the image in tiles of tileSize x tileSize pixels during assignment, 0=linear (default=0)." << endl
+              << "    -kernel\tNearest-centroid search: brute, partial=early abandon over bands sorted by variance (default=brute)." << endl
+              << "    -bench\tTime every assignment kernel on the final centroids and check they agree with brute." << endl
+              << "    -repro\tSum the centroids and the variance by fixed chunks in a fixed order, bitwise identical results for any number of threads." << endl
               << "    -s\tVisualize the results of algorithm execution." << endl
+              << "    -frames\tSave the RGB image and the clusters of every iteration as PPM files named with prefix (e.g. frames/), works without GUI." << endl
+              << "    -save\tSave the centroids of every k to the model file <prefix>k<k>.model." << endl
+              << "    -predict\tLabel the cube in input (same samples and bands) with a saved model and write the labels as int32 to output." << endl
               << "    -o\tWrite resulting clusters to log file." << endl
               << "    -t\tWrite execution time to log file." << endl
               << endl << flush;
@@ -1,21 +1,34 @@
 #include <iostream>
 #include <sstream>
+#include <string>
 
 #ifndef ARGPARSER_H
 #define ARGPARSER_H
 
 using namespace std;
 
+// Nearest-centroid search used during assignment
+enum AssignKernel { KERNEL_BRUTE, KERNEL_PARTIAL };
+// How the model of k is built from the model of k-1 during an incremental search
+enum IncrementalMode { INCREMENTAL_NONE, INCREMENTAL_SPLIT, INCREMENTAL_PLUSPLUS, INCREMENTAL_BISECT };
+
 struct ArgsParser {
-    ArgsParser() : numClusters(10), maxIterations(10), dataUsage(1), searchParallelThreads(1), kmeansParallelThreads(0), searchClusters(false), displayClusters(false), writeOutputLog(false), writeTimeLog(false) {};
+    ArgsParser() : numClusters(10), maxIterations(10), dataUsage(1), searchParallelThreads(1), kmeansParallelThreads(0), tileSize(0), multiResPasses(0), assignKernel(KERNEL_BRUTE), incrementalMode(INCREMENTAL_NONE), searchClusters(false), displayClusters(false), writeOutputLog(false), writeTimeLog(false), benchmarkKernels(false), reproducible(false) {};
 
     int parse(int argc, char **argv);
 
-    int numClusters, maxIterations, dataUsage, searchParallelThreads, kmeansParallelThreads;
+    int numClusters, maxIterations, dataUsage, searchParallelThreads, kmeansParallelThreads, tileSize, multiResPasses;
+    AssignKernel assignKernel;
+    IncrementalMode incrementalMode;
     bool searchClusters;
     bool displayClusters;
     bool writeOutputLog;
     bool writeTimeLog;
+    bool benchmarkKernels;
+    bool reproducible;
+    string framesPrefix;
+    string modelPrefix;
+    string predictModel, predictInput, predictOutput;
 };
 
 void printHelp(char *arg0);
@@ -0,0 +1,49 @@
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+#ifndef BLOCKINGQUEUE_H
+#define BLOCKINGQUEUE_H
+
+// Queue connecting the stages of a pipeline running on different threads. push waits while the queue is full,
+// pop waits while it is empty and returns false once the queue has been closed and drained.
+template<typename T>
+class BlockingQueue {
+
+private:
+    size_t capacity;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool closed = false;
+
+public:
+    explicit BlockingQueue(size_t capacity) : capacity(capacity) {}
+
+    void push(const T &item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return items.size() < capacity; });
+        items.push_back(item);
+        changed.notify_all();
+    }
+
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty())
+            return false;
+        item = items.front();
+        items.pop_front();
+        changed.notify_all();
+        return true;
+    }
+
+    // No more items will be pushed
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        changed.notify_all();
+    }
+};
+
+#endif // BLOCKINGQUEUE_H
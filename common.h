@@ -4,16 +4,83 @@
 #include <iostream>
 #include <fstream>
 #include <valarray>
+#include <algorithm>
 
 using namespace std;
 
-// Calculate the Euclidean distance between a and b.
+#if defined(__GNUC__)
+#define PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define PREFETCH(addr)
+#endif
+#if defined(__GNUC__)
+#define UNROLL_LOOP _Pragma("GCC unroll 64")
+#else
+#define UNROLL_LOOP
+#endif
+#define CACHE_LINE_SIZE 64
+// Number of partial sums accumulated in parallel by squaredDistanceFixed
+#define FIXED_DISTANCE_LANES 8
+// Number of values summed between two checks of the running sum in partialDistance
+#define PARTIAL_DISTANCE_CHUNK 16
+
+// Calculate the squared Euclidean distance between a and b.
 template<typename S, typename T>
-double distance(const S *a, const T *b, unsigned int numVals) {
+double squaredDistance(const S *a, const T *b, unsigned int numVals) {
     double sumSq = 0.0;
     for (unsigned int i = 0; i < numVals; i++)
         sumSq += (a[i] - b[i]) * (a[i] - b[i]);
-    return sqrt(sumSq);
+    return sumSq;
+}
+
+// Calculate the Euclidean distance between a and b.
+template<typename S, typename T>
+double distance(const S *a, const T *b, unsigned int numVals) {
+    return sqrt(squaredDistance(a, b, numVals));
+}
+
+// Same as squaredDistance with the number of values known at compile time. The values are summed in
+// FIXED_DISTANCE_LANES independent partial sums, so that the unrolled loop (completely up to 64 values) is not
+// serialised on a single accumulator and can be vectorised; the result may differ from squaredDistance in the last
+// bits.
+template<int NumVals, typename S, typename T>
+double squaredDistanceFixed(const S *a, const T *b) {
+    double lanes[FIXED_DISTANCE_LANES] = {0};
+    int i, l;
+    UNROLL_LOOP
+    for (i = 0; i + FIXED_DISTANCE_LANES <= NumVals; i += FIXED_DISTANCE_LANES)
+        for (l = 0; l < FIXED_DISTANCE_LANES; l++)
+            lanes[l] += (a[i + l] - b[i + l]) * (a[i + l] - b[i + l]);
+    for (l = 0; i < NumVals; i++, l++)
+        lanes[l] += (a[i] - b[i]) * (a[i] - b[i]);
+    double sumSq = 0.0;
+    for (l = 0; l < FIXED_DISTANCE_LANES; l++)
+        sumSq += lanes[l];
+    return sumSq;
+}
+
+// Calculate the squared Euclidean distance between a and b, abandoning the sum as soon as it exceeds bound.
+// The returned value is exact only when it is not greater than bound.
+template<typename S, typename T>
+double partialDistance(const S *a, const T *b, unsigned int numVals, double bound) {
+    double sumSq = 0.0;
+    unsigned int i = 0, chunkEnd;
+    while (i < numVals) {
+        chunkEnd = std::min(i + PARTIAL_DISTANCE_CHUNK, numVals);
+        for (; i < chunkEnd; i++)
+            sumSq += (a[i] - b[i]) * (a[i] - b[i]);
+        if (sumSq > bound)
+            return sumSq;
+    }
+    return sumSq;
+}
+
+// Request the cache lines holding the |numVals| values starting at a
+template<typename T>
+void prefetchValues(const T *a, unsigned int numVals) {
+    const char *start = (const char *) a, *end = (const char *) (a + numVals);
+    for (; start < end; start += CACHE_LINE_SIZE)
+        PREFETCH(start);
 }
 
 // Spread an addition of |numVals| values starting from src into the |numVals| of dest
@@ -1,78 +1,264 @@
 #include "dataManager.h"
 #include "common.h"
+#include "blockingQueue.h"
+#include <algorithm>
+#include <random>
+#include <thread>
 #ifdef USE_OMP
 #include <omp.h>
 #endif
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 
 template<typename T>
-int readFile(const char *fileName, long long numVals, T *array, long long offset = 0L);
+bool readValues(ifstream &fin, long long numVals, T *array);
 
+// Read the cube in blocks of LOAD_BLOCK_LINES lines and convert them to the HWC format as soon as they arrive:
+// a reader thread fills a ring of LOAD_SLOTS buffers while the OpenMP team transposes the previous blocks, replaces
+// the -9999 values and gathers the statistics, so that the loading time approaches the reading time. Only the
+// processed image and the ring are allocated. On Linux the kernel is asked to read ahead of the ring.
 float *DataManager::loadData() {
-    float *image = new float[samples*lines*bands], *processedImage = new float[samples*lines*bands];
-    int ret = readFile<float>(fileName, samples*lines*bands, image);
+    long lineValues = (long) samples * bands;
+    int i, j, k;
 
-    if (ret>0) {
-        cout << "readFile returned " << ret << "." << endl;
+    ifstream fin(fileName, std::ios_base::binary);
+    if (!fin) {
+        cout << "Unable to open " << fileName << " in loadData." << endl;
         return nullptr;
     }
-
-    int i = 0, j = 0, k = 0;
-    int offset_HW = samples * lines;  // (BSQ format)
-    int offset_CW = bands * samples;  // (BIL format)
+#ifdef __linux__
+    // a second descriptor only to give hints on the page cache, which is shared with fin
+    int hintFd = open(fileName, O_RDONLY);
+#endif
+    float *processedImage = new float[lineValues * lines];
+    double *bandSum = new double[bands](), *bandSumSq = new double[bands]();
     float maxR = std::numeric_limits<float>::min(), maxG = std::numeric_limits<float>::min(), maxB = std::numeric_limits<float>::min();
-    int threads = 1;
+    // the bands are transposed in their original position, the order by variance is known at the end
+    int *identity = new int[bands];
+    for (k = 0; k < bands; k++)
+        identity[k] = k;
+
+    struct Block {
+        int firstLine;
+        int numLines;
+        float *raw;
+    };
+    Block slots[LOAD_SLOTS];
+    BlockingQueue<Block *> freeSlots(LOAD_SLOTS), readSlots(LOAD_SLOTS);
+    for (i = 0; i < LOAD_SLOTS; i++) {
+        slots[i].raw = new float[LOAD_BLOCK_LINES * lineValues];
+        freeSlots.push(&slots[i]);
+    }
+    bool readFailed = false;
+
+    std::thread reader([&] {
+        Block *block;
+        for (int line = 0; line < lines && freeSlots.pop(block); line += LOAD_BLOCK_LINES) {
+            block->firstLine = line;
+            block->numLines = std::min(LOAD_BLOCK_LINES, lines - line);
+#ifdef __linux__
+            if (hintFd >= 0)
+                posix_fadvise(hintFd, (off_t) (line + LOAD_SLOTS * LOAD_BLOCK_LINES) * lineValues * sizeof(float),
+                              (off_t) LOAD_BLOCK_LINES * lineValues * sizeof(float), POSIX_FADV_WILLNEED);
+#endif
+            if (!readValues(fin, block->numLines * lineValues, block->raw)) {
+                readFailed = true;
+                break;
+            }
+            readSlots.push(block);
+        }
+        readSlots.close();
+    });
 
     // pre-process into HWC standard format and acquire max value in RGB bands for normalization
+    Block *block;
+    while (readSlots.pop(block)) {
+        transposeBlock(block->raw, processedImage + block->firstLine * lineValues, block->numLines, identity);
+        if (sortBands)
+            accumulateBandStatistics(block->raw, block->numLines, bandSum, bandSumSq);
+        for (i = 0; i < block->numLines; i++) {
+            const float *line = block->raw + i * lineValues;
+            for (j = 0; j < samples; j++) {
+                maxR = std::max(maxR, line[R * samples + j]);
+                maxG = std::max(maxG, line[G * samples + j]);
+                maxB = std::max(maxB, line[B * samples + j]);
+            }
+        }
+        freeSlots.push(block);
+    }
+    reader.join();
+#ifdef __linux__
+    if (hintFd >= 0)
+        close(hintFd);
+#endif
+    for (i = 0; i < LOAD_SLOTS; i++)
+        delete[] slots[i].raw;
+    delete[] identity;
+    if (readFailed) {
+        cout << "Unable to read " << lines << " lines from " << fileName << " in loadData." << endl;
+        delete[] processedImage;
+        delete[] bandSum;
+        delete[] bandSumSq;
+        return nullptr;
+    }
+
+    // move the bands of every pixel to their position in the order by variance
+    computeBandOrder(bandSum, bandSumSq);
+    delete[] bandSum;
+    delete[] bandSumSq;
+    int *bandPosition = new int[bands];
+    for (k = 0; k < bands; k++)
+        bandPosition[bandOrder[k]] = k;
+    if (sortBands) {
+        long p, numPixels = (long) samples * lines;
 #ifdef USE_OMP
-    threads = omp_get_num_threads();
-    #pragma omp parallel for collapse(2) default(shared) private(k) reduction(max:maxR, maxG, maxB)
+        #pragma omp parallel default(shared) private(k)
 #endif
-        for (i = 0; i < lines; i++) {
-            for (j = 0; j < samples; j++) {
+        {
+            float *pixel = new float[bands];
+#ifdef USE_OMP
+            #pragma omp for
+#endif
+            for (p = 0; p < numPixels; p++) {
+                float *values = processedImage + p * bands;
                 for (k = 0; k < bands; k++)
-                    if (image[(i * offset_CW) + (k * samples) + j] == -9999)
-                        processedImage[(i * offset_CW) + (j * bands) + k] = 0;
-                    else processedImage[(i * offset_CW) + (j * bands) + k] = image[(i * offset_CW) + (k * samples) + j];
-
-                // get max in red channel
-                maxR = threads>1? image[(i * offset_CW) + (R * samples) + j] : maxR<image[(i * offset_CW) + (R * samples) + j]? image[(i * offset_CW) + (R * samples) + j] : maxR;
-                // get max in green channel
-                maxG = threads>1? image[(i * offset_CW) + (G * samples) + j] : maxG<image[(i * offset_CW) + (G * samples) + j]? image[(i * offset_CW) + (G * samples) + j] : maxG;
-                // get max in blue channel
-                maxB = threads>1? image[(i * offset_CW) + (B * samples) + j] : maxB<image[(i * offset_CW) + (B * samples) + j]? image[(i * offset_CW) + (B * samples) + j] : maxB;
+                    pixel[bandPosition[k]] = values[k];
+                std::copy(pixel, pixel + bands, values);
             }
+            delete[] pixel;
         }
+    }
 
     this->rescaleFactorR = (1/maxR * 255);
     this->rescaleFactorG = (1/maxG * 255);
     this->rescaleFactorB = (1/maxB * 255);
+    // RGB bands are read from their new position
+    R = bandPosition[R], G = bandPosition[G], B = bandPosition[B];
+    delete[] bandPosition;
 
     return processedImage;
 }
 
-#ifdef USE_SDL
-void DataManager::showData(GUIRenderer *gui, float *data) {
-    Uint8 *rgb = new Uint8 [samples*lines*3];
+// Build a spatially stratified subsample of data: the image is split in blocks of blockRows x blockCols pixels and
+// one pixel is drawn at random from each block. The sample keeps the HWC layout of a sampleRows x sampleCols image.
+float *DataManager::sampleData(const float *data, int blockRows, int blockCols, int &sampleRows, int &sampleCols, unsigned int seed) {
+    sampleRows = (lines + blockRows - 1) / blockRows;
+    sampleCols = (samples + blockCols - 1) / blockCols;
+    long i, numSamples = (long) sampleRows * sampleCols;
+    float *sample = new float[numSamples * bands];
+    long *pixels = new long[numSamples];
+
+    // draw the pixels serially to keep the sample independent of the number of threads
+    std::mt19937 generator(seed);
+    for (i = 0; i < numSamples; i++) {
+        int row = (int) (i / sampleCols) * blockRows, col = (int) (i % sampleCols) * blockCols;
+        row += generator() % std::min(blockRows, lines - row);
+        col += generator() % std::min(blockCols, samples - col);
+        pixels[i] = (long) row * samples + col;
+    }
+#ifdef USE_OMP
+    #pragma omp parallel for default(shared)
+#endif
+    for (i = 0; i < numSamples; i++)
+        copyCentroidAddress(data + pixels[i] * bands, sample + i * bands, bands);
+
+    delete[] pixels;
+    return sample;
+}
+
+// Add the sums and the sums of squares of every band over numLines lines of the BIL format, where every band of
+// a line is contiguous; -9999 values count as 0 as in the processed image.
+void DataManager::accumulateBandStatistics(const float *bil, int numLines, double *bandSum, double *bandSumSq) const {
+    int i, j, k;
+#ifdef USE_OMP
+    #pragma omp parallel for default(shared) private(i, j)
+#endif
+    for (k = 0; k < bands; k++) {
+        double value;
+        for (i = 0; i < numLines; i++) {
+            const float *band = bil + ((long) i * bands + k) * samples;
+            for (j = 0; j < samples; j++) {
+                value = band[j] == -9999 ? 0 : band[j];
+                bandSum[k] += value;
+                bandSumSq[k] += value * value;
+            }
+        }
+    }
+}
+
+// Compute the order in which bands are stored: identity, or by decreasing variance when sortBands is set.
+// Bands with larger variance discriminate better between clusters, so that a partial distance computed on the first
+// bands grows faster and can be abandoned earlier. The statistics are accumulated by accumulateBandStatistics.
+void DataManager::computeBandOrder(const double *bandSum, const double *bandSumSq) {
+    int k;
+    delete[] bandOrder;
+    bandOrder = new int[bands];
+    for (k = 0; k < bands; k++)
+        bandOrder[k] = k;
+    if (!sortBands)
+        return;
+
+    double *variance = new double[bands];
+    long numPixels = (long) samples * lines;
+    for (k = 0; k < bands; k++)
+        variance[k] = bandSumSq[k] / numPixels - (bandSum[k] / numPixels) * (bandSum[k] / numPixels);
+    std::stable_sort(bandOrder, bandOrder + bands, [variance](int a, int b) { return variance[a] > variance[b]; });
+    delete[] variance;
+}
+
+// Convert numLines lines from the BIL format of the file to the HWC format used by the algorithm, moving band k to
+// position bandPosition[k] of every pixel and replacing the -9999 no-data values with 0
+void DataManager::transposeBlock(const float *bil, float *pixels, int numLines, const int *bandPosition) const {
+    int i, j, k;
+    long lineValues = (long) samples * bands;
+#ifdef USE_OMP
+    #pragma omp parallel for collapse(2) default(shared) private(k)
+#endif
+    for (i = 0; i < numLines; i++) {
+        for (j = 0; j < samples; j++) {
+            const float *src = bil + i * lineValues + j;
+            float *dest = pixels + i * lineValues + (long) j * bands;
+            for (k = 0; k < bands; k++)
+                dest[bandPosition[k]] = src[(long) k * samples] == -9999 ? 0 : src[(long) k * samples];
+        }
+    }
+}
+
+// Reconstruct an RGB24 image from the bands nearest to red, green and blue
+unsigned char *DataManager::composeRGB(const float *data) const {
+    unsigned char *rgb = new unsigned char [samples*lines*3];
     int i = 0, j = 0;
     int offset = samples * bands;
 
     for (i = 0; i < lines; i++) {
         for (j = 0; j < samples; j++) {
-            rgb[(i*3*samples)+(j*3)+0] = (Uint8) (data[(i*offset) + (j * bands) + R] * rescaleFactorR);  //R
-            rgb[(i*3*samples)+(j*3)+1] = (Uint8) (data[(i*offset) + (j * bands) + G] * rescaleFactorG);  //G
-            rgb[(i*3*samples)+(j*3)+2] = (Uint8) (data[(i*offset) + (j * bands) + B] * rescaleFactorB);  //B
+            rgb[(i*3*samples)+(j*3)+0] = (unsigned char) (data[(i*offset) + (j * bands) + R] * rescaleFactorR);  //R
+            rgb[(i*3*samples)+(j*3)+1] = (unsigned char) (data[(i*offset) + (j * bands) + G] * rescaleFactorG);  //G
+            rgb[(i*3*samples)+(j*3)+2] = (unsigned char) (data[(i*offset) + (j * bands) + B] * rescaleFactorB);  //B
         }
     }
-    imageSurface = SDL_CreateRGBSurfaceWithFormatFrom(rgb, samples, lines, 8, samples*3, SDL_PIXELFORMAT_RGB24);
-    gui->renderSurface(imageSurface);
+    return rgb;
+}
+
+#ifdef USE_SDL
+void DataManager::showData(GUIRenderer *gui, float *data) {
+    unsigned char *rgb = composeRGB(data);
+    gui->setImage(rgb, samples, lines);
+    delete[] rgb;
+    // a new window receives the current palette, later ones are sent by showClustersOverlay when they change
+    if(numColors > 0)
+        gui->setPalette(colorsArray, numColors);
 }
 
+// The colours of the clusters are spread over the hue circle and blended at half opacity over the image.
+// The palette is handed over only when it changes; the cluster map is handed over as a snapshot, the GUI draws it
+// on its own thread.
 void DataManager::showClustersOverlay(GUIRenderer *gui, int* pixelsMap, int numClusters) {
-    SDL_Surface* overlay = SDL_DuplicateSurface(imageSurface);
-    SDL_PixelFormat *format = SDL_AllocFormat(SDL_PIXELFORMAT_RGBA32);
-    overlay = SDL_ConvertSurface(overlay, format, 0);
-    if(colorsArray == nullptr){
+    if(numColors != numClusters){
+        free(colorsArray);
         colorsArray  = (SDL_Color *)malloc(numClusters*sizeof(SDL_Color));
         int i;
         for (i = 0; i < numClusters; i++) {
@@ -80,50 +266,27 @@ void DataManager::showClustersOverlay(GUIRenderer *gui, int* pixelsMap, int numC
             colorsArray[i].r = rgb[0];
             colorsArray[i].g = rgb[1];
             colorsArray[i].b = rgb[2];
-            colorsArray[i].a = 10;
+            colorsArray[i].a = 128;
+            delete[] rgb;
         }
+        numColors = numClusters;
+        gui->setPalette(colorsArray, numClusters);
     }
-    SDL_FreeFormat(format);
-
-    gui->lockSurface(overlay);
-    int i, sample, line;
-    for (i = 0; i < samples * lines ; ++i) {
-        line = i / samples;
-        sample = i % samples;
-        SDL_Color c = colorsArray[pixelsMap[i]];
-        gui->setPixelSurface(overlay, sample, line, c);
-    }
-    gui->unlockSurface(overlay);
-    gui->renderSurface(overlay);
-
-    if(clustersSurface != nullptr)
-        SDL_FreeSurface(clustersSurface);
-    clustersSurface = overlay;
+    gui->submitOverlay(pixelsMap, (long) samples * lines);
 }
 #endif
 
+// Read numVals values from the current position of fin, in chunks of at most LONG_MAX bytes (the largest count
+// accepted by a single read where long has 32 bits). Returns false if the values could not be read.
 template<typename T>
-int readFile(const char *fileName, long long numVals, T *array, long long offset) {
-    ifstream fin;
-
-    fin.open(fileName, std::ios_base::binary);
-    if (!fin) {
-        std::cout << "Unable to open " << fileName << " in readFile." << std::endl;
-        return 1;
-    }
-
+bool readValues(ifstream &fin, long long numVals, T *array) {
     long long val = numVals * (long long)sizeof(T);
-    long long file_offset = offset * (long long)sizeof(T);
-    long long array_address = 0;
-    fin.seekg(file_offset, std::ios_base::beg);
-    if(val>LONG_MAX){
-        while(val>0){
-            fin.read((char *) array+array_address, LONG_MAX);
-            val-=LONG_MAX;
-            array_address+=LONG_MAX;
-        }
-    }else fin.read((char *) array+array_address, val);
-
-    fin.close();
-    return 0;
+    char *address = (char *) array;
+    while (val > 0 && fin) {
+        long long chunk = std::min(val, (long long) LONG_MAX);
+        fin.read(address, chunk);
+        val -= chunk;
+        address += chunk;
+    }
+    return (bool) fin;
 }
@@ -17,6 +17,11 @@ using namespace std;
 #ifndef DATAMANAGER_H
 #define DATAMANAGER_H
 
+// Lines of the cube read as a single block by loadData
+#define LOAD_BLOCK_LINES 16
+// Blocks in flight between the reader thread of loadData and the transposition
+#define LOAD_SLOTS 4
+
 class DataManager {
 
 private:
@@ -41,27 +46,34 @@ private:
     int R = 58-1, G = 33-1, B = 19-1;
     // normalization [0-255] factors for corresponding bands
     float rescaleFactorR = 1, rescaleFactorG = 1, rescaleFactorB = 1;
+    // when requested the bands are stored sorted by decreasing variance; bandOrder[i] is the original index of the
+    // band stored in position i
+    bool sortBands;
+    int *bandOrder = nullptr;
+
+    void accumulateBandStatistics(const float *bil, int numLines, double *bandSum, double *bandSumSq) const;
+    void computeBandOrder(const double *bandSum, const double *bandSumSq);
 #ifdef USE_SDL
     SDL_Color* colorsArray = nullptr;
-    SDL_Surface* imageSurface = nullptr;
-    SDL_Surface* clustersSurface = nullptr;
+    int numColors = 0;
 #endif
 
 public:
-    DataManager(int dataQt){
+    DataManager(int dataQt, bool sortBands = false) : sortBands(sortBands) {
         // compute the quantity of data you want to use
         lines = lines/pow(2,4-dataQt);
     }
     int getSamples() const { return samples; }
     int getLines() const { return lines; }
     int getBands() const { return bands; }
+    const int *getBandOrder() const { return bandOrder; }
 
     float *loadData();
+    unsigned char *composeRGB(const float *data) const;
+    void transposeBlock(const float *bil, float *pixels, int numLines, const int *bandPosition) const;
+    float *sampleData(const float *data, int blockRows, int blockCols, int &sampleRows, int &sampleCols, unsigned int seed);
 
 #ifdef USE_SDL
-    SDL_Surface* getImage() const { return imageSurface; }
-    SDL_Surface* getClustersImage() const { return clustersSurface; }
-
     void showData(GUIRenderer *gui, float *data);
     void showClustersOverlay(GUIRenderer *gui, int *pixelsMap, int numClusters);
 #endif
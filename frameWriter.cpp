@@ -0,0 +1,82 @@
+#include "frameWriter.h"
+#include "common.h"
+#include <cstdio>
+
+FrameWriter::FrameWriter(const string &prefix, const unsigned char *rgb, int width, int height)
+        : prefix(prefix), width(width), height(height), freeFrames(MAX_PENDING_FRAMES), filledFrames(MAX_PENDING_FRAMES) {
+    image = new unsigned char[(long) width * height * 3];
+    std::copy(rgb, rgb + (long) width * height * 3, image);
+    for (int i = 0; i < MAX_PENDING_FRAMES; i++) {
+        slots[i].pixelsMap = new int[(long) width * height];
+        freeFrames.push(&slots[i]);
+    }
+    worker = std::thread(&FrameWriter::run, this);
+}
+
+// Encode the frames left in the queue, then stop the worker
+FrameWriter::~FrameWriter() {
+    filledFrames.close();
+    worker.join();
+    for (int i = 0; i < MAX_PENDING_FRAMES; i++)
+        delete[] slots[i].pixelsMap;
+    delete[] image;
+}
+
+// Queue a copy of the cluster map of the given iteration
+void FrameWriter::submit(int numClusters, int iteration, const int *pixelsMap) {
+    Frame *frame = nullptr;
+    freeFrames.pop(frame);
+    frame->numClusters = numClusters;
+    frame->iteration = iteration;
+    std::copy(pixelsMap, pixelsMap + (long) width * height, frame->pixelsMap);
+    filledFrames.push(frame);
+}
+
+void FrameWriter::run() {
+    unsigned char *rgb = new unsigned char[(long) width * height * 3];
+    writePPM(prefix + "image.ppm", image);
+    Frame *frame;
+    while (filledFrames.pop(frame)) {
+        encode(frame, rgb);
+        freeFrames.push(frame);
+    }
+    delete[] rgb;
+}
+
+// Blend the colours of the clusters, spread over the hue circle, at half opacity over the composite
+void FrameWriter::encode(const Frame *frame, unsigned char *rgb) {
+    unsigned char *palette = new unsigned char[frame->numClusters * 3];
+    int i;
+    for (i = 0; i < frame->numClusters; i++) {
+        int *color = HSVtoRGB((i*360)/frame->numClusters, 100, 100);
+        palette[i * 3 + 0] = color[0];
+        palette[i * 3 + 1] = color[1];
+        palette[i * 3 + 2] = color[2];
+        delete[] color;
+    }
+    long p, numPixels = (long) width * height;
+    for (p = 0; p < numPixels; p++) {
+        const unsigned char *color = palette + frame->pixelsMap[p] * 3;
+        rgb[p * 3 + 0] = (image[p * 3 + 0] + color[0]) / 2;
+        rgb[p * 3 + 1] = (image[p * 3 + 1] + color[1]) / 2;
+        rgb[p * 3 + 2] = (image[p * 3 + 2] + color[2]) / 2;
+    }
+    delete[] palette;
+
+    char name[32];
+    snprintf(name, sizeof(name), "k%02d_iter%03d.ppm", frame->numClusters, frame->iteration);
+    writePPM(prefix + name, rgb);
+}
+
+bool FrameWriter::writePPM(const string &fileName, const unsigned char *rgb) {
+    ofstream fout(fileName, std::ios_base::binary);
+    if (!fout) {
+        if (!writeFailed)
+            std::cout << "Unable to open " << fileName << " in FrameWriter, frames are not saved." << std::endl;
+        writeFailed = true;
+        return false;
+    }
+    fout << "P6\n" << width << " " << height << "\n255\n";
+    fout.write((const char *) rgb, (long) width * height * 3);
+    return true;
+}
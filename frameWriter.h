@@ -0,0 +1,48 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include "blockingQueue.h"
+
+#ifndef FRAMEWRITER_H
+#define FRAMEWRITER_H
+
+using namespace std;
+
+// Snapshot buffers of the cluster map, allocated once; submit waits for a free one when all are waiting to be encoded
+#define MAX_PENDING_FRAMES 8
+
+// Headless capture of the iterations: writes the RGB composite of the image and, for every submitted cluster map,
+// a frame with the clusters colours blended over the composite. Frames are binary PPM files named
+// <prefix>image.ppm and <prefix>k<k>_iter<iteration>.ppm; the encoding runs on a background thread so that
+// submit only costs the copy of the cluster map in a preallocated snapshot. Can be shared by the threads of a
+// parallel search.
+class FrameWriter {
+
+private:
+    struct Frame {
+        int numClusters, iteration;
+        int *pixelsMap;
+    };
+
+    string prefix;
+    int width, height;
+    unsigned char *image;
+    Frame slots[MAX_PENDING_FRAMES];
+    BlockingQueue<Frame *> freeFrames, filledFrames;
+    bool writeFailed = false;
+    std::thread worker;
+
+    void run();
+    void encode(const Frame *frame, unsigned char *rgb);
+    bool writePPM(const string &fileName, const unsigned char *rgb);
+
+public:
+    FrameWriter(const string &prefix, const unsigned char *rgb, int width, int height);
+    ~FrameWriter();
+    FrameWriter(const FrameWriter &) = delete;
+    FrameWriter &operator=(const FrameWriter &) = delete;
+
+    void submit(int numClusters, int iteration, const int *pixelsMap);
+};
+
+#endif // FRAMEWRITER_H
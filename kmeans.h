@@ -2,15 +2,55 @@
 #define KMEANS_H
 
 #include <stdlib.h>
+#include <limits>
+#include <random>
+#include <algorithm>
 #include "common.h"
 
 #if defined(_OPENMP)
+#include <omp.h>
 #define USE_OMP true
 #endif
 
 using namespace std;
 
+// Fraction of reassigned objects under which an execution is considered converged
+#define CONVERGENCE_THRESHOLD 0.001
+
+// Index of the calling thread in the team and size of the team
+#ifdef USE_OMP
+#define TEAM_THREAD omp_get_thread_num()
+#define TEAM_SIZE omp_get_num_threads()
+#else
+#define TEAM_THREAD 0
+#define TEAM_SIZE 1
+#endif
+
+// Objects summed by each chunk of the reproducible reductions. The chunks do not depend on the number of threads
+// and their partial sums are combined in a fixed order, so that the results are bitwise identical for any team.
+#define REPRO_CHUNK 16384
+
+// Sums the numValues-long partials of numChunks chunks along a fixed pairwise tree, leaving the total in the first
+// chunk. Executed by every thread of the team.
+inline void treeReduceTeam(double *partials, long numChunks, long numValues) {
+    long stride, c, v;
+    for (stride = 1; stride < numChunks; stride *= 2) {
+#ifdef USE_OMP
+        #pragma omp for collapse(2)
+#endif
+        for (c = 0; c < (numChunks - 1) / (2 * stride) + 1; c++)
+            for (v = 0; v < numValues; v++)
+                if (2 * stride * c + stride < numChunks)
+                    partials[2 * stride * c * numValues + v] += partials[(2 * stride * c + stride) * numValues + v];
+    }
+}
+
+// The functions with the Team suffix are executed by every thread of an already started parallel region (or by a
+// single thread out of it) and share the work with orphaned worksharing constructs. This lets an execution keep
+// one parallel region alive for all its iterations; the functions without suffix start their own region.
+
 // Computes the cluster centers by averaging all objects assigned to each cluster.
+// Every thread accumulates its objects in its own partial sums, which are then reduced by cluster.
 // ARGUMENTS:
 //   data		An array with numObjects * dataDepth elements
 //   objMapping		numObjects long array whose elements will associate each
@@ -22,61 +62,103 @@ using namespace std;
 //			numClusters - 1.
 //   dataDepth		Depth of each object and also vectors contained in centroids.
 //   clustersSize	An array to receive the number of pixels assigned to each cluster
-#ifdef USE_OMP
+//   threadSums		An array with TEAM_SIZE * numClusters * dataDepth elements for the partial sums
+//   threadSizes	An array with TEAM_SIZE * numClusters elements for the partial sizes
 template<typename T>
-int computeCentroids(const T *data, const int *objMapping, long numObjects,
-                   float **centroids, int numClusters,
-                   int dataDepth, long *clustersSize) {
+void computeCentroidsTeam(const T *data, const int *objMapping, long numObjects,
+                          float **centroids, int numClusters, int dataDepth, long *clustersSize,
+                          float *threadSums, long *threadSizes) {
     long i;
-    int j;
+    int c, j, t, numThreads = TEAM_SIZE;
+    float *sums = threadSums + (long) TEAM_THREAD * numClusters * dataDepth;
+    long *sizes = threadSizes + (long) TEAM_THREAD * numClusters;
 
-    #pragma omp parallel sections default(shared)
-    {
-        #pragma omp section
-        std::fill(clustersSize, clustersSize + numClusters, 0);
-        #pragma omp section
-        for (i = 0; i < numClusters; i++) {
-            std::fill((centroids[i]), (centroids[i]) + dataDepth, 0.f);
-        }
+    std::fill(sums, sums + (long) numClusters * dataDepth, 0.f);
+    std::fill(sizes, sizes + numClusters, 0);
+#ifdef USE_OMP
+    #pragma omp for nowait
+#endif
+    for (i = 0; i < numObjects; i++) {
+        arrayAdd(data + i * dataDepth, sums + (long) objMapping[i] * dataDepth, dataDepth);
+        sizes[objMapping[i]] += 1;
     }
-    #pragma omp parallel default(shared)
-    {
-        #pragma omp for
-        for (i = 0; i < numObjects; i++) {
-            arrayAdd(data + i * dataDepth, centroids[objMapping[i]], dataDepth);
-            #pragma omp atomic
-            clustersSize[objMapping[i]] += 1;
+#ifdef USE_OMP
+    #pragma omp barrier
+    #pragma omp for
+#endif
+    for (c = 0; c < numClusters; c++) {
+        clustersSize[c] = 0;
+        std::fill(centroids[c], centroids[c] + dataDepth, 0.f);
+        for (t = 0; t < numThreads; t++) {
+            clustersSize[c] += threadSizes[(long) t * numClusters + c];
+            arrayAdd(threadSums + ((long) t * numClusters + c) * dataDepth, centroids[c], dataDepth);
         }
-        #pragma omp barrier
-        #pragma omp for collapse(2)
-        for (i = 0; i < (int) numClusters; i++) {
-            for (j = 0; j < dataDepth; j++)
-                centroids[i][j] /= clustersSize[i];
+        for (j = 0; j < dataDepth; j++)
+            centroids[c][j] /= clustersSize[c];
+    }
+}
+
+// Reproducible variant of computeCentroidsTeam: the objects are summed in double by chunks of REPRO_CHUNK objects,
+// combined with treeReduceTeam.
+//   chunkSums		An array with ceil(numObjects / REPRO_CHUNK) * numClusters * (dataDepth + 1) elements
+template<typename T>
+void computeCentroidsReproTeam(const T *data, const int *objMapping, long numObjects,
+                               float **centroids, int numClusters, int dataDepth, long *clustersSize,
+                               double *chunkSums) {
+    long i, chunk, numChunks = (numObjects + REPRO_CHUNK - 1) / REPRO_CHUNK;
+    long numValues = (long) numClusters * (dataDepth + 1);
+    int c, j;
+
+#ifdef USE_OMP
+    #pragma omp for
+#endif
+    for (chunk = 0; chunk < numChunks; chunk++) {
+        double *sums = chunkSums + chunk * numValues, *sizes = sums + (long) numClusters * dataDepth;
+        std::fill(sums, sums + numValues, 0.0);
+        for (i = chunk * REPRO_CHUNK; i < std::min(numObjects, (chunk + 1) * REPRO_CHUNK); i++) {
+            arrayAdd(data + i * dataDepth, sums + (long) objMapping[i] * dataDepth, dataDepth);
+            sizes[objMapping[i]] += 1;
         }
     }
-    return 0;
+    treeReduceTeam(chunkSums, numChunks, numValues);
+#ifdef USE_OMP
+    #pragma omp for
+#endif
+    for (c = 0; c < numClusters; c++) {
+        clustersSize[c] = (long) chunkSums[(long) numClusters * dataDepth + c];
+        for (j = 0; j < dataDepth; j++)
+            centroids[c][j] = (float) (chunkSums[(long) c * dataDepth + j] / clustersSize[c]);
+    }
 }
-#else
+
 template<typename T>
 int computeCentroids(const T *data, const int *objMapping, long numObjects,
                    float **centroids, int numClusters,
-                   int dataDepth, long *clustersSize) {
-    long i;
-    int j;
-    std::fill(clustersSize, clustersSize + numClusters, 0);
-    for (i = 0; i < numClusters; i++) {
-        std::fill((centroids[i]), (centroids[i]) + dataDepth, 0.f);
-    }
-    for (i = 0; i < numObjects; i++) {
-        arrayAdd(data + i * dataDepth, centroids[objMapping[i]], dataDepth);
-        clustersSize[objMapping[i]] += 1;
+                   int dataDepth, long *clustersSize, bool reproducible = false) {
+    if (reproducible) {
+        double *chunkSums = new double[(numObjects + REPRO_CHUNK - 1) / REPRO_CHUNK * numClusters * (dataDepth + 1)];
+#ifdef USE_OMP
+        #pragma omp parallel default(shared)
+#endif
+        computeCentroidsReproTeam(data, objMapping, numObjects, centroids, numClusters, dataDepth, clustersSize, chunkSums);
+        delete[] chunkSums;
+        return 0;
     }
-    for (i = 0; i < (int) numClusters; i++) {
-        for (j = 0; j < dataDepth; j++)
-            centroids[i][j] /= clustersSize[i];
-    } return 0;
-}
+#ifdef USE_OMP
+    int numThreads = omp_get_max_threads();
+#else
+    int numThreads = 1;
+#endif
+    float *threadSums = new float[(long) numThreads * numClusters * dataDepth];
+    long *threadSizes = new long[(long) numThreads * numClusters];
+#ifdef USE_OMP
+    #pragma omp parallel default(shared) num_threads(numThreads)
 #endif
+    computeCentroidsTeam(data, objMapping, numObjects, centroids, numClusters, dataDepth, clustersSize, threadSums, threadSizes);
+    delete[] threadSums;
+    delete[] threadSizes;
+    return 0;
+}
 
 // Calculates clusterMap, which associates each object with one of the elements of centroids.
 // ARGUMENTS:
@@ -89,20 +171,24 @@ int computeCentroids(const T *data, const int *objMapping, long numObjects,
 //   numClusters	Length of centroids.  Also, max value in objMapping is
 //			numClusters - 1.
 //   dataDepth		Depth of each object and also vectors contained in centroids.
+//   numChanged		Shared counter receiving the number of objects which changed cluster
 template<typename T>
-long assignObjects(const T *data, int *objMapping, long numObjects, float **centroids,
-                  int numClusters, int dataDepth) {
-    long i, numChanged = 0;
+void assignObjectsTeam(const T *data, int *objMapping, long numObjects, float **centroids,
+                       int numClusters, int dataDepth, long *numChanged) {
+    long i, localChanged = 0;
     int j;
     double dist, minDist;
     int nearestCluster;
     const T *pixel;
 
 #ifdef USE_OMP
-#pragma omp parallel default(shared) private(pixel, nearestCluster, minDist, j, dist)
-#pragma omp for reduction(+:numChanged)
+#pragma omp single
 #endif
-    for (i = 0; i < (int) numObjects; i++) {
+    *numChanged = 0;
+#ifdef USE_OMP
+#pragma omp for nowait
+#endif
+    for (i = 0; i < numObjects; i++) {
         pixel = data + i * dataDepth;
 
         // Determine the cluster nearest to this pixel
@@ -116,9 +202,298 @@ long assignObjects(const T *data, int *objMapping, long numObjects, float **cent
             }
         }
         if (objMapping[i] != nearestCluster)
-            numChanged += 1;
+            localChanged += 1;
+        objMapping[i] = nearestCluster;
+    }
+#ifdef USE_OMP
+#pragma omp atomic
+#endif
+    *numChanged += localChanged;
+#ifdef USE_OMP
+#pragma omp barrier
+#endif
+}
+
+template<typename T>
+long assignObjects(const T *data, int *objMapping, long numObjects, float **centroids,
+                  int numClusters, int dataDepth) {
+    long numChanged;
+#ifdef USE_OMP
+#pragma omp parallel default(shared)
+#endif
+    assignObjectsTeam(data, objMapping, numObjects, centroids, numClusters, dataDepth, &numChanged);
+    return numChanged;
+}
+
+// Copy the centroids in a contiguous block of numClusters * dataDepth values, the layout read by
+// assignObjectsFixedTeam
+inline void packCentroids(float **centroids, int numClusters, int dataDepth, float *packedCentroids) {
+    for (int c = 0; c < numClusters; c++)
+        std::copy(centroids[c], centroids[c] + dataDepth, packedCentroids + (long) c * dataDepth);
+}
+
+// Same as assignObjectsTeam with the number of bands (Depth) and of clusters (Clusters, 0 when given by
+// numClusters at run time) fixed at compile time. The centroids are read from the packed block with the compile
+// time stride, the distance loop is unrolled and the nearest cluster is chosen on the squared distance.
+// Instantiated by assignObjectsFixedTeam for the configurations listed there.
+template<int Depth, int Clusters, typename T>
+void assignObjectsFixedKernel(const T *data, int *objMapping, long numObjects, const float *model,
+                              int numClusters, long *numChanged) {
+    const int clusters = Clusters > 0 ? Clusters : numClusters;
+    long i, localChanged = 0;
+    int j, nearestCluster;
+    double dist, minDist;
+    const T *pixel;
+
+#ifdef USE_OMP
+#pragma omp single
+#endif
+    *numChanged = 0;
+#ifdef USE_OMP
+#pragma omp for nowait
+#endif
+    for (i = 0; i < numObjects; i++) {
+        pixel = data + i * Depth;
+
+        nearestCluster = 0;
+        minDist = squaredDistanceFixed<Depth>(pixel, model);
+        for (j = 1; j < clusters; j++) {
+            dist = squaredDistanceFixed<Depth>(pixel, model + (long) j * Depth);
+            if (dist < minDist) {
+                minDist = dist;
+                nearestCluster = j;
+            }
+        }
+        if (objMapping[i] != nearestCluster)
+            localChanged += 1;
+        objMapping[i] = nearestCluster;
+    }
+#ifdef USE_OMP
+#pragma omp atomic
+#endif
+    *numChanged += localChanged;
+#ifdef USE_OMP
+#pragma omp barrier
+#endif
+}
+
+// Largest number of clusters with a kernel specialised at compile time
+#define FIXED_MAX_CLUSTERS 8
+
+// Selects the kernel with Clusters equal to numClusters, trying Clusters from FIXED_MAX_CLUSTERS down to 2; the
+// kernel with the number of clusters given at run time is used for the other values.
+template<int Depth, int Clusters, typename T>
+struct FixedClustersDispatch {
+    static void run(const T *data, int *objMapping, long numObjects, const float *packedCentroids,
+                    int numClusters, long *numChanged) {
+        if (numClusters == Clusters)
+            assignObjectsFixedKernel<Depth, Clusters>(data, objMapping, numObjects, packedCentroids, numClusters, numChanged);
+        else
+            FixedClustersDispatch<Depth, Clusters - 1, T>::run(data, objMapping, numObjects, packedCentroids, numClusters, numChanged);
+    }
+};
+
+template<int Depth, typename T>
+struct FixedClustersDispatch<Depth, 1, T> {
+    static void run(const T *data, int *objMapping, long numObjects, const float *packedCentroids,
+                    int numClusters, long *numChanged) {
+        assignObjectsFixedKernel<Depth, 0>(data, objMapping, numObjects, packedCentroids, numClusters, numChanged);
+    }
+};
+
+template<int Depth, typename T>
+void assignObjectsFixedDepth(const T *data, int *objMapping, long numObjects, const float *packedCentroids,
+                             int numClusters, long *numChanged) {
+    FixedClustersDispatch<Depth, FIXED_MAX_CLUSTERS, T>::run(data, objMapping, numObjects, packedCentroids, numClusters, numChanged);
+}
+
+// Run the brute force assignment specialised for dataDepth, with the number of clusters also fixed when it is not
+// greater than FIXED_MAX_CLUSTERS. The band counts are the 425 bands of the AVIRIS-NG cubes and the widths 8, 16,
+// 32 and 64 of reduced data. Returns false, without touching objMapping, when dataDepth has no specialisation and
+// assignObjectsTeam must be used.
+// ARGUMENTS: as assignObjectsTeam, except
+//   packedCentroids	The centroids packed by packCentroids, numClusters * dataDepth values
+template<typename T>
+bool assignObjectsFixedTeam(const T *data, int *objMapping, long numObjects, const float *packedCentroids,
+                            int numClusters, int dataDepth, long *numChanged) {
+    switch (dataDepth) {
+        case 8: assignObjectsFixedDepth<8>(data, objMapping, numObjects, packedCentroids, numClusters, numChanged); return true;
+        case 16: assignObjectsFixedDepth<16>(data, objMapping, numObjects, packedCentroids, numClusters, numChanged); return true;
+        case 32: assignObjectsFixedDepth<32>(data, objMapping, numObjects, packedCentroids, numClusters, numChanged); return true;
+        case 64: assignObjectsFixedDepth<64>(data, objMapping, numObjects, packedCentroids, numClusters, numChanged); return true;
+        case 425: assignObjectsFixedDepth<425>(data, objMapping, numObjects, packedCentroids, numClusters, numChanged); return true;
+        default: return false;
+    }
+}
+
+// Returns the number of objects which changed cluster, or -1 when dataDepth has no specialisation
+template<typename T>
+long assignObjectsFixed(const T *data, int *objMapping, long numObjects, float **centroids,
+                        int numClusters, int dataDepth) {
+    long numChanged = -1;
+    float *packedCentroids = new float[(long) numClusters * dataDepth];
+    packCentroids(centroids, numClusters, dataDepth, packedCentroids);
+#ifdef USE_OMP
+#pragma omp parallel default(shared)
+#endif
+    assignObjectsFixedTeam(data, objMapping, numObjects, packedCentroids, numClusters, dataDepth, &numChanged);
+    delete[] packedCentroids;
+    return numChanged;
+}
+
+// Same as assignObjects, but the distance of each candidate is accumulated in chunks of bands and abandoned as
+// soon as it exceeds the distance of the best cluster found so far. The search starts from the cluster currently
+// in objMapping, which is usually the nearest one and gives a tight bound from the first candidate. The result
+// is exact; the gain grows when the data bands are sorted by decreasing variance (see DataManager).
+// ARGUMENTS:
+//   data		An array with numObjects * dataDepth elements
+//   objMapping		numObjects long array whose elements will associate each
+//			object with a specific cluster. Must contain valid cluster indices.
+//   numObjects		Number of objects  (each of which has dataDepth elements).
+//   centroids		A numClusters long array of pointers to dataDepth-length
+//			arrays that define the cluster locations
+//   numClusters	Length of centroids.  Also, max value in objMapping is
+//			numClusters - 1.
+//   dataDepth		Depth of each object and also vectors contained in centroids.
+//   numChanged		Shared counter receiving the number of objects which changed cluster
+template<typename T>
+void assignObjectsPartialTeam(const T *data, int *objMapping, long numObjects, float **centroids,
+                              int numClusters, int dataDepth, long *numChanged) {
+    long i, localChanged = 0;
+    int j, previousCluster, nearestCluster;
+    double dist, minDist;
+    const T *pixel;
+
+#ifdef USE_OMP
+#pragma omp single
+#endif
+    *numChanged = 0;
+#ifdef USE_OMP
+#pragma omp for nowait
+#endif
+    for (i = 0; i < numObjects; i++) {
+        pixel = data + i * dataDepth;
+
+        previousCluster = nearestCluster = objMapping[i];
+        minDist = partialDistance(pixel, centroids[previousCluster], dataDepth, std::numeric_limits<double>::max());
+        for (j = 0; j < numClusters; j++) {
+            if (j == previousCluster)
+                continue;
+            dist = partialDistance(pixel, centroids[j], dataDepth, minDist);
+            if (dist < minDist || (dist == minDist && j < nearestCluster)) {
+                minDist = dist;
+                nearestCluster = j;
+            }
+        }
+        if (previousCluster != nearestCluster)
+            localChanged += 1;
         objMapping[i] = nearestCluster;
     }
+#ifdef USE_OMP
+#pragma omp atomic
+#endif
+    *numChanged += localChanged;
+#ifdef USE_OMP
+#pragma omp barrier
+#endif
+}
+
+template<typename T>
+long assignObjectsPartial(const T *data, int *objMapping, long numObjects, float **centroids,
+                          int numClusters, int dataDepth) {
+    long numChanged;
+#ifdef USE_OMP
+#pragma omp parallel default(shared)
+#endif
+    assignObjectsPartialTeam(data, objMapping, numObjects, centroids, numClusters, dataDepth, &numChanged);
+    return numChanged;
+}
+
+// Same as assignObjects, but the image is visited in square tiles of tileSize x tileSize pixels so that
+// neighbouring (and highly correlated) pixels are processed one after the other. The winner of the previous
+// pixel in the tile is tested first and its distance is used as bound to abandon early the other candidates.
+// While a pixel is processed the bands of the next one are prefetched.
+// ARGUMENTS:
+//   data		An array with numRows * numCols * dataDepth elements
+//   objMapping		numRows * numCols long array whose elements will associate each
+//			object with a specific cluster.
+//   numRows		Number of lines of the image.
+//   numCols		Number of samples of the image.
+//   centroids		A numClusters long array of pointers to dataDepth-length
+//			arrays that define the cluster locations
+//   numClusters	Length of centroids.  Also, max value in objMapping is
+//			numClusters - 1.
+//   dataDepth		Depth of each object and also vectors contained in centroids.
+//   tileSize		Side of the tiles in pixels.
+//   numChanged		Shared counter receiving the number of objects which changed cluster
+template<typename T>
+void assignObjectsTiledTeam(const T *data, int *objMapping, int numRows, int numCols, float **centroids,
+                            int numClusters, int dataDepth, int tileSize, long *numChanged) {
+    long localChanged = 0;
+    int tilesPerRow = (numCols + tileSize - 1) / tileSize;
+    int numTiles = tilesPerRow * ((numRows + tileSize - 1) / tileSize);
+    int t;
+
+#ifdef USE_OMP
+#pragma omp single
+#endif
+    *numChanged = 0;
+#ifdef USE_OMP
+#pragma omp for schedule(dynamic) nowait
+#endif
+    for (t = 0; t < numTiles; t++) {
+        int rowStart = (t / tilesPerRow) * tileSize, colStart = (t % tilesPerRow) * tileSize;
+        int rowEnd = std::min(rowStart + tileSize, numRows), colEnd = std::min(colStart + tileSize, numCols);
+        int r, c, j, nearestCluster, lastWinner = 0;
+        long idx;
+        double dist, minDist;
+        const T *pixel;
+
+        for (r = rowStart; r < rowEnd; r++) {
+            for (c = colStart; c < colEnd; c++) {
+                idx = (long) r * numCols + c;
+                pixel = data + idx * dataDepth;
+                if (c + 1 < colEnd)
+                    prefetchValues(pixel + dataDepth, dataDepth);
+                else if (r + 1 < rowEnd)
+                    prefetchValues(data + ((long) (r + 1) * numCols + colStart) * dataDepth, dataDepth);
+
+                // Start from the cluster of the previous pixel, then look for a nearer one
+                nearestCluster = lastWinner;
+                minDist = partialDistance(pixel, centroids[lastWinner], dataDepth, std::numeric_limits<double>::max());
+                for (j = 0; j < numClusters; j++) {
+                    if (j == lastWinner)
+                        continue;
+                    dist = partialDistance(pixel, centroids[j], dataDepth, minDist);
+                    if (dist < minDist || (dist == minDist && j < nearestCluster)) {
+                        minDist = dist;
+                        nearestCluster = j;
+                    }
+                }
+                if (objMapping[idx] != nearestCluster)
+                    localChanged += 1;
+                objMapping[idx] = nearestCluster;
+                lastWinner = nearestCluster;
+            }
+        }
+    }
+#ifdef USE_OMP
+#pragma omp atomic
+#endif
+    *numChanged += localChanged;
+#ifdef USE_OMP
+#pragma omp barrier
+#endif
+}
+
+template<typename T>
+long assignObjectsTiled(const T *data, int *objMapping, int numRows, int numCols, float **centroids,
+                        int numClusters, int dataDepth, int tileSize) {
+    long numChanged;
+#ifdef USE_OMP
+#pragma omp parallel default(shared)
+#endif
+    assignObjectsTiledTeam(data, objMapping, numRows, numCols, centroids, numClusters, dataDepth, tileSize, &numChanged);
     return numChanged;
 }
 
@@ -132,12 +507,36 @@ long assignObjects(const T *data, int *objMapping, long numObjects, float **cent
 //   centroids		A numClusters long array of pointers to dataDepth-length
 //			arrays that define the cluster locations
 //   dataDepth		Depth of each object and also vectors contained in centers.
+//   reproducible	Sum by chunks combined in a fixed order, independent of the number of threads.
 template<typename T>
-double computeClusterVariance(const T *data, int *objMapping, long numObjects, float **centroids, int dataDepth) {
+double computeClusterVariance(const T *data, int *objMapping, long numObjects, float **centroids, int dataDepth,
+                              bool reproducible = false) {
     long i;
     double clustersVariance = 0;
     const T *pixel;
 
+    if (reproducible) {
+        long chunk, numChunks = (numObjects + REPRO_CHUNK - 1) / REPRO_CHUNK;
+        double *partials = new double[numChunks];
+#ifdef USE_OMP
+#pragma omp parallel default(shared) private(i)
+#endif
+        {
+#ifdef USE_OMP
+#pragma omp for
+#endif
+            for (chunk = 0; chunk < numChunks; chunk++) {
+                partials[chunk] = 0;
+                for (i = chunk * REPRO_CHUNK; i < std::min(numObjects, (chunk + 1) * REPRO_CHUNK); i++)
+                    partials[chunk] += distance(data + i * dataDepth, centroids[objMapping[i]], dataDepth)/dataDepth;
+            }
+            treeReduceTeam(partials, numChunks, 1);
+        }
+        clustersVariance = partials[0];
+        delete[] partials;
+        return clustersVariance;
+    }
+
 #ifdef USE_OMP
 #pragma omp parallel for default(shared) private(pixel) reduction(+:clustersVariance)
 #endif
@@ -148,5 +547,228 @@ double computeClusterVariance(const T *data, int *objMapping, long numObjects, f
     return clustersVariance;
 }
 
+// Calculates the sum of squared distances between the objects and their centroid for every cluster.
+// ARGUMENTS:
+//   data		An array with numObjects * dataDepth elements
+//   objMapping		numObjects long array associating each object with a cluster.
+//   numObjects		Number of objects  (each of which has dataDepth elements).
+//   centroids		A numClusters long array of pointers to dataDepth-length arrays
+//   numClusters	Length of centroids.
+//   dataDepth		Depth of each object and also vectors contained in centroids.
+//   clustersSSE	An array to receive the sum of squared errors of each cluster
+// The sums are made by chunks as in computeCentroidsReproTeam, so the result does not depend on the threads.
+template<typename T>
+void computeClustersSSE(const T *data, const int *objMapping, long numObjects, float **centroids,
+                        int numClusters, int dataDepth, double *clustersSSE) {
+    long i, chunk, numChunks = (numObjects + REPRO_CHUNK - 1) / REPRO_CHUNK;
+    double *partials = new double[numChunks * numClusters];
+#ifdef USE_OMP
+#pragma omp parallel default(shared) private(i)
+#endif
+    {
+#ifdef USE_OMP
+#pragma omp for
+#endif
+        for (chunk = 0; chunk < numChunks; chunk++) {
+            double *sse = partials + chunk * numClusters;
+            std::fill(sse, sse + numClusters, 0.0);
+            for (i = chunk * REPRO_CHUNK; i < std::min(numObjects, (chunk + 1) * REPRO_CHUNK); i++)
+                sse[objMapping[i]] += squaredDistance(data + i * dataDepth, centroids[objMapping[i]], dataDepth);
+        }
+        treeReduceTeam(partials, numChunks, numClusters);
+    }
+    copyCentroidAddress(partials, clustersSSE, numClusters);
+    delete[] partials;
+}
+
+// Splits cluster into two centroids placed at one standard deviation (per band) on either side of its centroid.
+// The centroid of cluster is moved to the lower side and newCluster receives the upper side.
+// The sums are made by chunks as in computeCentroidsReproTeam, so the result does not depend on the threads.
+template<typename T>
+void splitCentroid(const T *data, const int *objMapping, long numObjects, float **centroids,
+                   int cluster, int newCluster, int dataDepth) {
+    long i, chunk, numChunks = (numObjects + REPRO_CHUNK - 1) / REPRO_CHUNK;
+    int j;
+    // per chunk: dataDepth sums of squares followed by the number of objects
+    double *partials = new double[numChunks * (dataDepth + 1)];
+    const T *pixel;
+
+#ifdef USE_OMP
+#pragma omp parallel default(shared) private(i, pixel, j)
+#endif
+    {
+#ifdef USE_OMP
+#pragma omp for
+#endif
+        for (chunk = 0; chunk < numChunks; chunk++) {
+            double *sumSq = partials + chunk * (dataDepth + 1);
+            std::fill(sumSq, sumSq + dataDepth + 1, 0.0);
+            for (i = chunk * REPRO_CHUNK; i < std::min(numObjects, (chunk + 1) * REPRO_CHUNK); i++) {
+                if (objMapping[i] != cluster)
+                    continue;
+                pixel = data + i * dataDepth;
+                for (j = 0; j < dataDepth; j++)
+                    sumSq[j] += (pixel[j] - centroids[cluster][j]) * (pixel[j] - centroids[cluster][j]);
+                sumSq[dataDepth] += 1;
+            }
+        }
+        treeReduceTeam(partials, numChunks, dataDepth + 1);
+    }
+    double *sumSq = partials, count = partials[dataDepth];
+    for (j = 0; j < dataDepth; j++) {
+        float deviation = count > 0 ? (float) sqrt(sumSq[j] / count) : 0.f;
+        centroids[newCluster][j] = centroids[cluster][j] + deviation;
+        centroids[cluster][j] -= deviation;
+    }
+    delete[] partials;
+}
+
+// Places the centroid of newCluster on an object drawn with probability proportional to its squared distance from
+// the centroid it is assigned to (k-means++ seeding).
+template<typename T>
+void sampleCentroidPlusPlus(const T *data, const int *objMapping, long numObjects, float **centroids,
+                            int newCluster, int dataDepth, unsigned int seed) {
+    long i;
+    double *cumulative = new double[numObjects];
+#ifdef USE_OMP
+#pragma omp parallel for default(shared)
+#endif
+    for (i = 0; i < numObjects; i++)
+        cumulative[i] = squaredDistance(data + i * dataDepth, centroids[objMapping[i]], dataDepth);
+    for (i = 1; i < numObjects; i++)
+        cumulative[i] += cumulative[i - 1];
+
+    std::mt19937 generator(seed);
+    if (cumulative[numObjects - 1] > 0) {
+        double target = std::uniform_real_distribution<double>(0, cumulative[numObjects - 1])(generator);
+        i = std::upper_bound(cumulative, cumulative + numObjects, target) - cumulative;
+        if (i >= numObjects)
+            i = numObjects - 1;
+    } else {
+        // every object lies on its centroid: no object is more likely than another
+        i = generator() % numObjects;
+    }
+    copyCentroidAddress(data + i * dataDepth, centroids[newCluster], dataDepth);
+    delete[] cumulative;
+}
+
+// Bisects cluster with a 2-means restricted to its objects, seeded by splitCentroid. The objects moved to the second
+// half are assigned to newCluster; the other clusters are left untouched. Returns the number of iterations performed.
+template<typename T>
+int bisectCluster(const T *data, int *objMapping, long numObjects, float **centroids,
+                  int cluster, int newCluster, int dataDepth, int maxIterations, bool reproducible = false) {
+    long i, numMembers = 0, numChanged;
+    int iterations;
+    for (i = 0; i < numObjects; i++)
+        numMembers += objMapping[i] == cluster;
+    long *members = new long[numMembers];
+    for (i = 0, numMembers = 0; i < numObjects; i++)
+        if (objMapping[i] == cluster)
+            members[numMembers++] = i;
+
+    splitCentroid(data, objMapping, numObjects, centroids, cluster, newCluster, dataDepth);
+    float *pair[2] = {centroids[cluster], centroids[newCluster]};
+    int *halves = new int[numMembers]();
+    long halvesSize[2];
+    float *pairData = new float[numMembers * dataDepth];
+    for (i = 0; i < numMembers; i++)
+        copyCentroidAddress(data + members[i] * dataDepth, pairData + i * dataDepth, dataDepth);
+
+    numChanged = assignObjects(pairData, halves, numMembers, pair, 2, dataDepth);
+    for (iterations = 1; iterations < maxIterations && numChanged > numMembers * CONVERGENCE_THRESHOLD; iterations++) {
+        computeCentroids(pairData, halves, numMembers, pair, 2, dataDepth, halvesSize, reproducible);
+        numChanged = assignObjects(pairData, halves, numMembers, pair, 2, dataDepth);
+    }
+    for (i = 0; i < numMembers; i++)
+        objMapping[members[i]] = halves[i] ? newCluster : cluster;
+
+    delete[] members;
+    delete[] halves;
+    delete[] pairData;
+    return iterations;
+}
+
+// Buffers used by the executions of one search thread. They are allocated once for the largest k of the search
+// and reused for every k, so that neither the iterations nor the move to the next k allocate memory. Two models
+// are kept to let the incremental search build k from k-1 (see swapModels).
+// ARGUMENTS:
+//   numObjects		Number of objects to cluster.
+//   maxClusters	Largest number of clusters computed.
+//   dataDepth		Depth of each object and also vectors contained in centroids.
+//   numThreads		Largest team executing computeCentroidsTeam.
+//   reproducible	Also allocate the chunk partials of computeCentroidsReproTeam.
+struct KMeansArena {
+    KMeansArena(long numObjects, int maxClusters, int dataDepth, int numThreads, bool reproducible = false)
+            : numObjects(numObjects), numThreads(numThreads) {
+        long i;
+        for (int m = 0; m < 2; m++) {
+            centroidsStorage[m] = new float[(long) maxClusters * dataDepth]();
+            models[m] = new float*[maxClusters];
+            for (i = 0; i < maxClusters; i++)
+                models[m][i] = centroidsStorage[m] + i * dataDepth;
+            maps[m] = new int[numObjects];
+        }
+        centroids = models[0], previousCentroids = models[1];
+        objMapping = maps[0], previousMapping = maps[1];
+        clustersSize = new long[maxClusters]();
+        threadSums = new float[(long) numThreads * maxClusters * dataDepth]();
+        threadSizes = new long[(long) numThreads * maxClusters]();
+        packedCentroids = new float[(long) maxClusters * dataDepth];
+        chunkSums = reproducible ? new double[(numObjects + REPRO_CHUNK - 1) / REPRO_CHUNK * maxClusters * (dataDepth + 1)] : nullptr;
+        // touch the maps from the threads that will use them
+#ifdef USE_OMP
+        #pragma omp parallel for default(shared) num_threads(numThreads)
+#endif
+        for (i = 0; i < numObjects; i++)
+            maps[0][i] = maps[1][i] = 0;
+    }
+    KMeansArena(const KMeansArena &) = delete;
+    KMeansArena &operator=(const KMeansArena &) = delete;
+    ~KMeansArena() {
+        for (int m = 0; m < 2; m++) {
+            delete[] centroidsStorage[m];
+            delete[] models[m];
+            delete[] maps[m];
+        }
+        delete[] clustersSize;
+        delete[] threadSums;
+        delete[] threadSizes;
+        delete[] packedCentroids;
+        delete[] chunkSums;
+    }
+
+    // Prepare the current model for a new execution: every object starts in cluster 0
+    void reset() {
+        long i;
+#ifdef USE_OMP
+        #pragma omp parallel for default(shared) num_threads(numThreads)
+#endif
+        for (i = 0; i < numObjects; i++)
+            objMapping[i] = 0;
+    }
+
+    // The current model becomes the previous one
+    void swapModels() {
+        std::swap(centroids, previousCentroids);
+        std::swap(objMapping, previousMapping);
+    }
+
+    long numObjects;
+    int numThreads;
+    float **centroids, **previousCentroids;
+    int *objMapping, *previousMapping;
+    long *clustersSize;
+    float *threadSums;
+    long *threadSizes;
+    // centroids of the current iteration in the layout of assignObjectsFixedTeam
+    float *packedCentroids;
+    double *chunkSums;
+
+private:
+    float *centroidsStorage[2];
+    float **models[2];
+    int *maps[2];
+};
+
 #endif // KMEANS_H
 
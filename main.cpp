@@ -1,8 +1,11 @@
 #include <iostream>
 #include <algorithm>
+#include <chrono>
 #include "argsParser.h"
 #include "dataManager.h"
 #include "kmeans.h"
+#include "frameWriter.h"
+#include "predictor.h"
 #if defined(SDL_VERSION) || defined(USE_SDL)
 #include "GUIRenderer.h"
 #define USE_SDL true
@@ -29,6 +32,182 @@ using namespace std;
  *
  ****************************************************************************/
 
+// Assign every pixel to the nearest centroid visiting the image as requested from command line.
+// Executed by every thread of the calling team, numChanged is shared.
+// packedCentroids holds the centroids packed by packCentroids, read by the kernels specialised for numBands
+static void assignPixelsTeam(const ArgsParser &parser, const float *data, int *pixelsMap, int numRows, int numCols,
+                             float **centroids, const float *packedCentroids, int numClusters, int numBands,
+                             long *numChanged) {
+    if (parser.tileSize > 0)
+        assignObjectsTiledTeam(data, pixelsMap, numRows, numCols, centroids, numClusters, numBands, parser.tileSize, numChanged);
+    else if (parser.assignKernel == KERNEL_PARTIAL)
+        assignObjectsPartialTeam(data, pixelsMap, (long) numRows * numCols, centroids, numClusters, numBands, numChanged);
+    else if (!assignObjectsFixedTeam(data, pixelsMap, (long) numRows * numCols, packedCentroids, numClusters, numBands, numChanged))
+        assignObjectsTeam(data, pixelsMap, (long) numRows * numCols, centroids, numClusters, numBands, numChanged);
+}
+
+// packedCentroids is a scratch buffer of numClusters * numBands values
+static long assignPixels(const ArgsParser &parser, const float *data, int *pixelsMap, int numRows, int numCols,
+                         float **centroids, float *packedCentroids, int numClusters, int numBands) {
+    long numChanged;
+#ifdef USE_OMP
+    #pragma omp parallel default(shared)
+#endif
+    {
+    #ifdef USE_OMP
+        #pragma omp single
+    #endif
+        packCentroids(centroids, numClusters, numBands, packedCentroids);
+        assignPixelsTeam(parser, data, pixelsMap, numRows, numCols, centroids, packedCentroids, numClusters, numBands, &numChanged);
+    }
+    return numChanged;
+}
+
+// Time every assignment kernel starting from the same cluster map and count the pixels where the result differs
+// from the brute force search, then compare the centroid update with its reproducible variant
+static void benchmarkKernels(const ArgsParser &parser, const float *data, const int *pixelsMap, int numRows, int numCols,
+                             float **centroids, int numClusters, int numBands) {
+    const char *names[] = {"brute", "fixed", "partial", "tiled"};
+    long i, numPixels = (long) numRows * numCols, numDiffer;
+    int *reference = new int[numPixels], *labels = new int[numPixels];
+    for (int kernel = 0; kernel < 4; kernel++) {
+        std::copy(pixelsMap, pixelsMap + numPixels, labels);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (kernel == 0)
+            assignObjects(data, labels, numPixels, centroids, numClusters, numBands);
+        else if (kernel == 1) {
+            if (assignObjectsFixed(data, labels, numPixels, centroids, numClusters, numBands) < 0) {
+                printf("(k=%d) Kernel fixed: no specialisation for %d bands\n", numClusters, numBands); fflush(stdout);
+                continue;
+            }
+        }
+        else if (kernel == 2)
+            assignObjectsPartial(data, labels, numPixels, centroids, numClusters, numBands);
+        else
+            assignObjectsTiled(data, labels, numRows, numCols, centroids, numClusters, numBands, parser.tileSize > 0 ? parser.tileSize : 16);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (kernel == 0)
+            std::copy(labels, labels + numPixels, reference);
+        for (i = 0, numDiffer = 0; i < numPixels; i++)
+            numDiffer += labels[i] != reference[i];
+
+        printf("(k=%d) Kernel %s: %f seconds, %ld pixels differ from brute\n", numClusters, names[kernel], seconds, numDiffer); fflush(stdout);
+        if(parser.writeTimeLog) {
+    #ifdef USE_OMP
+    #pragma omp critical
+    #endif
+            {
+                std::ofstream fout; fout.open("time.log", ios::app);
+                fout << "(k=" << numClusters << ") Kernel " << names[kernel] << ": " << seconds << " seconds, " << numDiffer << " pixels differ from brute" << std::endl;
+                fout.close();
+            }
+        }
+    }
+
+    // cost and drift of the reproducible centroid reduction, computed on copies of the final centroids
+    long *clustersSize = new long[numClusters];
+    float **fast = new float*[numClusters], **repro = new float*[numClusters];
+    for (int c = 0; c < numClusters; c++) {
+        fast[c] = new float[numBands];
+        repro[c] = new float[numBands];
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    computeCentroids(data, pixelsMap, numPixels, fast, numClusters, numBands, clustersSize);
+    double fastSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    computeCentroids(data, pixelsMap, numPixels, repro, numClusters, numBands, clustersSize, true);
+    double reproSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    double maxDifference = 0;
+    for (int c = 0; c < numClusters; c++) {
+        for (int j = 0; j < numBands; j++)
+            maxDifference = std::max(maxDifference, (double) std::abs(fast[c][j] - repro[c][j]));
+        delete[] fast[c];
+        delete[] repro[c];
+    }
+    printf("(k=%d) Centroids: %f seconds, reproducible %f seconds, max difference %g\n",
+           numClusters, fastSeconds, reproSeconds, maxDifference); fflush(stdout);
+    if(parser.writeTimeLog) {
+#ifdef USE_OMP
+#pragma omp critical
+#endif
+        {
+            std::ofstream fout; fout.open("time.log", ios::app);
+            fout << "(k=" << numClusters << ") Centroids: " << fastSeconds << " seconds, reproducible " << reproSeconds
+                 << " seconds, max difference " << maxDifference << std::endl;
+            fout.close();
+        }
+    }
+    delete[] fast;
+    delete[] repro;
+    delete[] clustersSize;
+    delete[] reference;
+    delete[] labels;
+}
+
+// Refine the centroids on spatially stratified subsamples of growing size before the passes over the whole data.
+// The whole cube is loaded and the -d option only chooses the coarsest level: the levels go from the fraction of
+// the cube that -d would load up to half of it (e.g. 1/16, 1/8, 1/4 and 1/2 of the pixels with -d 0, none with
+// -d 4). Each level starts from the centroids of the previous one and stops after maxIterations or when less than
+// 0.1% of the sample changes cluster.
+static void multiResolutionRefine(const ArgsParser &parser, DataManager &dataMgr, const float *data,
+                                  float **centroids, float *packedCentroids, int numClusters, long *clustersSize) {
+    int numBands = dataMgr.getBands(), numLevels = 4 - parser.dataUsage;
+    for (int level = 0; level < numLevels; level++) {
+        int fraction = numLevels - level;  // the sample is 1/2^fraction of the data
+        int sampleRows, sampleCols, iterations;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        float *sample = dataMgr.sampleData(data, 1 << ((fraction + 1) / 2), 1 << (fraction / 2), sampleRows, sampleCols, level);
+        long numSamples = (long) sampleRows * sampleCols, numChanged;
+        int *sampleMap = new int[numSamples]();
+
+        assignPixels(parser, sample, sampleMap, sampleRows, sampleCols, centroids, packedCentroids, numClusters, numBands);
+        for (iterations = 1; iterations < parser.maxIterations; ) {
+            computeCentroids(sample, sampleMap, numSamples, centroids, numClusters, numBands, clustersSize, parser.reproducible);
+            numChanged = assignPixels(parser, sample, sampleMap, sampleRows, sampleCols, centroids, packedCentroids, numClusters, numBands);
+            iterations++;
+            if (numChanged <= numSamples * CONVERGENCE_THRESHOLD)
+                break;
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        delete[] sample;
+        delete[] sampleMap;
+
+        printf("(k=%d) Level %d: %dx%d pixels (1/%d of data), %d iterations, %f seconds\n",
+               numClusters, level, sampleRows, sampleCols, 1 << fraction, iterations, seconds); fflush(stdout);
+        if(parser.writeTimeLog) {
+    #ifdef USE_OMP
+    #pragma omp critical
+    #endif
+            {
+                std::ofstream fout; fout.open("time.log", ios::app);
+                fout << "(k=" << numClusters << ") Level " << level << ": " << numSamples << " pixels (1/" << (1 << fraction)
+                     << " of data), " << iterations << " iterations, " << seconds << " seconds" << std::endl;
+                fout.close();
+            }
+        }
+    }
+}
+
+// Build the model of numClusters from the converged model of numClusters-1, already copied in the first
+// numClusters-1 centroids and in pixelsMap. Returns the number of iterations spent by bisection, 0 when the
+// refinement is left to the main loop.
+static int growModel(const ArgsParser &parser, const float *data, int *pixelsMap, long numPixels,
+                     float **centroids, int numClusters, int numBands) {
+    int newCluster = numClusters - 1;
+    if (parser.incrementalMode == INCREMENTAL_PLUSPLUS) {
+        sampleCentroidPlusPlus(data, pixelsMap, numPixels, centroids, newCluster, numBands, numClusters);
+        return 0;
+    }
+    double *clustersSSE = new double[newCluster];
+    computeClustersSSE(data, pixelsMap, numPixels, centroids, newCluster, numBands, clustersSSE);
+    int worstCluster = std::max_element(clustersSSE, clustersSSE + newCluster) - clustersSSE;
+    delete[] clustersSSE;
+    if (parser.incrementalMode == INCREMENTAL_BISECT)
+        return bisectCluster(data, pixelsMap, numPixels, centroids, worstCluster, newCluster, numBands, parser.maxIterations, parser.reproducible);
+    splitCentroid(data, pixelsMap, numPixels, centroids, worstCluster, newCluster, numBands);
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
 #ifdef USE_OMP
     printf("OpenMP enabled - Parallel execution with %d threads\n", omp_get_max_threads()); fflush(stdout);
@@ -52,14 +231,33 @@ int main(int argc, char *argv[]) {
         parser.displayClusters = false;
         printf("Multithreads ksearch doesn't support visualization - Show features disabled\n"); fflush(stdout);
     }
+    if(parser.incrementalMode != INCREMENTAL_NONE and !parser.searchClusters){
+        parser.incrementalMode = INCREMENTAL_NONE;
+        printf("Incremental search requires ksearch - Incremental features disabled\n"); fflush(stdout);
+    }
+    if(parser.incrementalMode != INCREMENTAL_NONE and (parser.searchParallelThreads!=1)){
+        parser.searchParallelThreads = 1;
+        printf("Incremental ksearch computes k values in sequence - Search threads set to 1\n"); fflush(stdout);
+    }
     bool displayClusters = parser.displayClusters;
+    bool incremental = parser.incrementalMode != INCREMENTAL_NONE;
+
+    // Label a new cube with a saved model
+    if(!parser.predictModel.empty()) {
+        DataManager predictMgr = DataManager(4);
+        return predictScene(predictMgr, parser.predictModel, parser.predictInput, parser.predictOutput,
+                            parser.tileSize > 0 ? parser.tileSize : 16);
+    }
 
     // Load data
 #ifdef USE_OMP
     double initial_start_time = omp_get_wtime(), start_time = omp_get_wtime();
     double time_per_cluster_iter = 0;
 #endif
-    DataManager dataMgr = DataManager(parser.dataUsage);
+    // the multi-resolution refinement samples the whole cube, -d only sets its coarsest level; the bands are sorted
+    // by variance for the kernels with early abandon (partial and tiled)
+    DataManager dataMgr = DataManager(parser.multiResPasses > 0 ? 4 : parser.dataUsage,
+                                      parser.assignKernel == KERNEL_PARTIAL || parser.tileSize > 0 || parser.benchmarkKernels);
     float *data = dataMgr.loadData();
     if(data == nullptr)
         return 1;
@@ -69,10 +267,30 @@ int main(int argc, char *argv[]) {
     printf("Data read\n"); fflush(stdout);
 #endif
 
+    // Headless capture of the iterations, shared by all the k values
+    FrameWriter *frameWriter = nullptr;
+    if(!parser.framesPrefix.empty()) {
+        unsigned char *rgb = dataMgr.composeRGB(data);
+        frameWriter = new FrameWriter(parser.framesPrefix, rgb, dataMgr.getSamples(), dataMgr.getLines());
+        delete[] rgb;
+    }
+
     // Variables to keep track of best k value search, initialized at first position
     int minK = parser.searchClusters? 2:parser.numClusters;
     int bestK = minK;
     long bestKVar = std::numeric_limits<long>::max();
+    long totalIterations = 0;
+
+    // Buffers of every search thread, sized for the largest k
+    int searchThreads = parser.searchClusters? parser.searchParallelThreads : 1;
+#ifdef USE_OMP
+    int kmeansThreads = parser.searchClusters? parser.kmeansParallelThreads : omp_get_max_threads();
+#else
+    int kmeansThreads = 1;
+#endif
+    KMeansArena **arenas = new KMeansArena*[searchThreads];
+    for (int t = 0; t < searchThreads; t++)
+        arenas[t] = new KMeansArena((long) dataMgr.getLines() * dataMgr.getSamples(), parser.numClusters, dataMgr.getBands(), kmeansThreads, parser.reproducible);
 
     // Make K-search
 #ifdef USE_OMP
@@ -94,6 +312,8 @@ int main(int argc, char *argv[]) {
         if(displayClusters) {
             gui = new GUIRenderer(SCREEN_WIDTH, SCREEN_HEIGHT);
             displayClusters = gui->guiInitialized;
+            if(!displayClusters)
+                delete gui;
         }
     #endif
 
@@ -107,71 +327,158 @@ int main(int argc, char *argv[]) {
 
         int numRows = dataMgr.getLines(), numCols = dataMgr.getSamples(), numBands = dataMgr.getBands();
         int numPixels = numRows * numCols;
+    #ifdef USE_OMP
+        KMeansArena &arena = *arenas[omp_get_thread_num()];
+    #else
+        KMeansArena &arena = *arenas[0];
+    #endif
         // Store an array containing the coordinates of the centroids. Each centroid is an array long `numBands`
-        float **centroids = new float*[numClusters];
-        for (i = 0; i < numClusters; i++)
-            centroids[i] =  new float[numBands];
+        float **centroids = arena.centroids;
         // Store an array containing the index of the cluster for each pixel
-        int *pixelsMap = new int[numRows * numCols];
+        int *pixelsMap = arena.objMapping;
         // Store an array containing the number of pixels associated to each cluster
-        long *clustersSize = new long[numClusters];
+        long *clustersSize = arena.clustersSize;
         long numChanged;
         int kMeansIterations;
 
+        // The incremental search starts from the model of k-1, which is grown after the timer is started
+        bool grown = incremental && k > minK;
         printf("(k=%d) Starting initialization..\n", numClusters);
-        for (i = 0; i < numClusters; i++) {
+        if(grown) {
+            for (i = 0; i < numClusters - 1; i++)
+                copyCentroidAddress(arena.previousCentroids[i], centroids[i], numBands);
+            copyCentroidAddress(arena.previousMapping, pixelsMap, numPixels);
+        } else for (i = 0; i < numClusters; i++) {
             // HWC save format
             copyCentroidAddress(data + ((i * numCols / numClusters) + (i * numRows / numClusters) * numCols) * numBands, centroids[i], numBands);
         }
-
-        printf("(k=%d) Starting iterate:\n", numClusters);
+        if(!grown)
+            arena.reset();
 
     #ifdef USE_OMP
+        // the refinement levels are part of the cost of this k
         start_time = omp_get_wtime();
     #endif
+        int maxIterations = parser.maxIterations;
+        if(parser.multiResPasses > 0 && !grown) {
+            printf("(k=%d) Starting multi-resolution refinement:\n", numClusters);
+            multiResolutionRefine(parser, dataMgr, data, centroids, arena.packedCentroids, numClusters, clustersSize);
+            maxIterations = parser.multiResPasses;
+        }
 
-        // First iteration
-        assignObjects(data, pixelsMap, numPixels, centroids, numClusters, numBands);
-        printf("(k=%d) Iteration 1... Initial cluster map calculated.\n", numClusters); fflush(stdout);
-        kMeansIterations = 1;
+        printf("(k=%d) Starting iterate:\n", numClusters);
+    #ifdef USE_OMP
+        // the time per iteration is measured on the passes over the whole data only
+        double iterate_start_time = omp_get_wtime();
+    #endif
 
-        // Update cluster map until max number of iterations has been reached or
-        // fewer than a threshold number of pixels are reassigned between iterations.
+        kMeansIterations = grown ? growModel(parser, data, pixelsMap, numPixels, centroids, numClusters, numBands) : 0;
+        bool firstIteration = kMeansIterations == 0, converged = false;
+        if(firstIteration) {
+            kMeansIterations = 1;
+        } else {
+            // bisecting k-means leaves the other clusters untouched
+            printf("(k=%d) Cluster bisected in %d iterations.\n", numClusters, kMeansIterations); fflush(stdout);
+            if(frameWriter != nullptr)
+                frameWriter->submit(numClusters, kMeansIterations, pixelsMap);
+            maxIterations = kMeansIterations;
+        }
 
-        for (; kMeansIterations < parser.maxIterations; kMeansIterations++) {
-    #ifdef USE_SDL
-            if(displayClusters)
-                dataMgr.showClustersOverlay(gui, pixelsMap, numClusters);
+        // A single parallel region lives for all the iterations, the phases are separated by the barriers of the
+        // Team functions. The master thread (the one owning the GUI) prints and renders between the phases.
+    #ifdef USE_OMP
+        #pragma omp parallel default(shared) num_threads(kmeansThreads)
     #endif
-            // New iteration
-            computeCentroids(data, pixelsMap, numPixels, centroids, numClusters, numBands, clustersSize);
-            numChanged = assignObjects(data, pixelsMap, numPixels, centroids, numClusters, numBands);
-            cout << "(k=" << numClusters << ") Iteration " << kMeansIterations + 1 << "... " << numChanged << " pixels reassigned." << endl << flush;
+        {
+            if(firstIteration) {
+                // First iteration
+            #ifdef USE_OMP
+                #pragma omp single
+            #endif
+                packCentroids(centroids, numClusters, numBands, arena.packedCentroids);
+                assignPixelsTeam(parser, data, pixelsMap, numRows, numCols, centroids, arena.packedCentroids, numClusters, numBands, &numChanged);
+            #ifdef USE_OMP
+                #pragma omp master
+            #endif
+                {
+                    printf("(k=%d) Iteration 1... Initial cluster map calculated.\n", numClusters); fflush(stdout);
+                    if(frameWriter != nullptr)
+                        frameWriter->submit(numClusters, 1, pixelsMap);
+                }
+            }
+
+            // Update cluster map until max number of iterations has been reached or
+            // fewer than a threshold number of pixels are reassigned between iterations.
+
+            while (kMeansIterations < maxIterations && !converged) {
+        #ifdef USE_SDL
+            #ifdef USE_OMP
+                #pragma omp master
+            #endif
+                if(displayClusters)
+                    dataMgr.showClustersOverlay(gui, pixelsMap, numClusters);
+        #endif
+                // New iteration
+                if(parser.reproducible)
+                    computeCentroidsReproTeam(data, pixelsMap, numPixels, centroids, numClusters, numBands, clustersSize,
+                                              arena.chunkSums);
+                else
+                    computeCentroidsTeam(data, pixelsMap, numPixels, centroids, numClusters, numBands, clustersSize,
+                                         arena.threadSums, arena.threadSizes);
+            #ifdef USE_OMP
+                #pragma omp single
+            #endif
+                packCentroids(centroids, numClusters, numBands, arena.packedCentroids);
+                assignPixelsTeam(parser, data, pixelsMap, numRows, numCols, centroids, arena.packedCentroids, numClusters, numBands, &numChanged);
+            #ifdef USE_OMP
+                #pragma omp single
+            #endif
+                {
+                    kMeansIterations++;
+                    cout << "(k=" << numClusters << ") Iteration " << kMeansIterations << "... " << numChanged << " pixels reassigned." << endl << flush;
+                    if(frameWriter != nullptr)
+                        frameWriter->submit(numClusters, kMeansIterations, pixelsMap);
+                    converged = parser.searchClusters && numChanged <= numPixels * CONVERGENCE_THRESHOLD;
+                }
+            }
         }
         /*-------------------------------------------------------------------------------------------*/
 
         // Write output results
+    #ifdef USE_OMP
+    #pragma omp atomic
+    #endif
+        totalIterations += kMeansIterations;
     #ifdef USE_OMP
         double end_time = omp_get_wtime();
+        double iteration_time = (end_time - iterate_start_time)/kMeansIterations;
         printf("(k=%d) Number of iterations: %d, total time: %f seconds, time per iteration: %f seconds\n",
-               numClusters, kMeansIterations, (end_time - start_time), (end_time - start_time)/kMeansIterations);
+               numClusters, kMeansIterations, (end_time - start_time), iteration_time);
         fflush(stdout);
-        time_per_cluster_iter += ((end_time - start_time)/(kMeansIterations*numClusters));
+        time_per_cluster_iter += iteration_time/numClusters;
         if(parser.writeTimeLog) {
             std::cout << "(k=" << numClusters << ") Writing execution time to file \"time.log\"." << std::endl;
             #pragma omp critical
             {
                 std::ofstream fout; fout.open("time.log", ios::app);
                 fout << "(k=" << numClusters << ") Number of iterations: " << kMeansIterations << ", total time: " << (end_time - start_time)
-                     << " seconds, time per iteration: " <<(end_time - start_time)/kMeansIterations<< " seconds\n" << std::endl;
+                     << " seconds, time per iteration: " << iteration_time << " seconds\n" << std::endl;
                 fout.close();
             }
         }
     #else
         printf("End of iterations\n"); fflush(stdout);
     #endif
-        double inVariance = computeClusterVariance(data, pixelsMap, numPixels, centroids, numBands);
+        double inVariance = computeClusterVariance(data, pixelsMap, numPixels, centroids, numBands, parser.reproducible);
         printf("(k=%d) Within-class variance: %f\n\n", numClusters, inVariance); fflush(stdout);
+        if(!parser.modelPrefix.empty()) {
+            std::ostringstream modelFile;
+            modelFile << parser.modelPrefix << "k" << numClusters << ".model";
+            std::cout << "(k=" << numClusters << ") Writing model file \"" << modelFile.str() << "\"." << std::endl;
+            saveModel(modelFile.str(), centroids, numClusters, numBands, dataMgr.getBandOrder());
+        }
+        if(parser.benchmarkKernels)
+            benchmarkKernels(parser, data, pixelsMap, numRows, numCols, centroids, numClusters, numBands);
 
     #ifdef USE_OMP
     #pragma omp critical
@@ -197,21 +504,15 @@ int main(int argc, char *argv[]) {
     #endif
         }
 
-    #ifdef USE_SDL  // Setup events loop
+        if(incremental)
+            arena.swapModels();
+
+    #ifdef USE_SDL  // Wait for the window to be closed
         if(displayClusters) {
-            bool quit = parser.searchClusters? true : false;
-            while (!quit) {
-                SDL_Event e;
-                SDL_WaitEvent(&e);
-                if (e.type == SDL_QUIT)
-                    quit = true;
-                else if (e.type == SDL_MOUSEBUTTONDOWN) {
-                    gui->renderSurface(dataMgr.getImage());
-                } else if (e.type == SDL_MOUSEBUTTONUP) {
-                    gui->renderSurface(dataMgr.getClustersImage());
-                }
-            }
-            gui->quit();
+            dataMgr.showClustersOverlay(gui, pixelsMap, numClusters);
+            if(!parser.searchClusters)
+                gui->waitClose();
+            delete gui;
         }
     #endif
 
@@ -228,13 +529,20 @@ int main(int argc, char *argv[]) {
 #ifdef USE_OMP
         float totTime = (omp_get_wtime() - initial_start_time);
         float kiterTime = time_per_cluster_iter/(parser.numClusters+1 - minK);
-        printf("Search executed in %f seconds, time per cluster iteration: %f\n", totTime, kiterTime);
+        printf("Search executed in %f seconds, %ld total iterations (%s), time per cluster iteration: %f\n", totTime,
+               totalIterations, incremental ? "incremental over k" : "independent k", kiterTime);
         if(parser.writeTimeLog)
-            fout << "Search executed in " << totTime << " seconds, time per cluster iteration: " << kiterTime << std::endl;
+            fout << "Search executed in " << totTime << " seconds, " << totalIterations << " total iterations ("
+                 << (incremental ? "incremental over k" : "independent k") << "), time per cluster iteration: " << kiterTime << std::endl;
 #endif
         if(parser.writeTimeLog) fout.close();
         fflush(stdout);
     }
 
+    delete frameWriter;  // waits for the frames still queued
+    for (int t = 0; t < searchThreads; t++)
+        delete arenas[t];
+    delete[] arenas;
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,202 @@
+#include "predictor.h"
+#include "blockingQueue.h"
+#include "kmeans.h"
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+// Write the centroids as text: "k=", "bands=" and one line of values per centroid. The bands are written in their
+// original order, so that a model does not depend on the order chosen to store the data.
+int saveModel(const string &fileName, float **centroids, int numClusters, int numBands, const int *bandOrder) {
+    ofstream fout(fileName);
+    if (!fout) {
+        cout << "Unable to open " << fileName << " in saveModel." << endl;
+        return 1;
+    }
+    float *values = new float[numBands];
+    int i, j;
+    fout << "k=" << numClusters << endl << "bands=" << numBands << endl << setprecision(9);
+    for (i = 0; i < numClusters; i++) {
+        for (j = 0; j < numBands; j++)
+            values[bandOrder[j]] = centroids[i][j];
+        for (j = 0; j < numBands; j++)
+            fout << values[j] << (j + 1 < numBands ? " " : "\n");
+    }
+    delete[] values;
+    return 0;
+}
+
+// Read a model written by saveModel. Returns nullptr if the file can not be read or its bands differ from numBands.
+float **loadModel(const string &fileName, int &numClusters, int numBands) {
+    ifstream fin(fileName);
+    string line;
+    int bands = 0, i, j;
+    if (!fin) {
+        cout << "Unable to open " << fileName << " in loadModel." << endl;
+        return nullptr;
+    }
+    numClusters = 0;
+    if (getline(fin, line) && line.compare(0, 2, "k=") == 0)
+        istringstream(line.substr(2)) >> numClusters;
+    if (getline(fin, line) && line.compare(0, 6, "bands=") == 0)
+        istringstream(line.substr(6)) >> bands;
+    if (numClusters < 1 || bands != numBands) {
+        cout << "Invalid model " << fileName << " in loadModel: expected " << numBands << " bands." << endl;
+        return nullptr;
+    }
+    float **centroids = new float*[numClusters];
+    for (i = 0; i < numClusters; i++) {
+        centroids[i] = new float[numBands];
+        for (j = 0; j < numBands; j++)
+            fin >> centroids[i][j];
+    }
+    if (!fin) {
+        cout << "Invalid model " << fileName << " in loadModel: missing values." << endl;
+        for (i = 0; i < numClusters; i++)
+            delete[] centroids[i];
+        delete[] centroids;
+        return nullptr;
+    }
+    return centroids;
+}
+
+// Label every pixel of a new cube (same samples, bands and BIL format of the training data) with the nearest
+// centroid of a saved model, writing the labels as int32 in row-major order. The cube is streamed in blocks of
+// PREDICT_BLOCK_LINES lines through three stages running concurrently: a reader thread, the labelling made by
+// this thread with the OpenMP team, and a writer thread. Memory use is bounded by PREDICT_SLOTS blocks, whatever
+// the size of the cube. The bands are stored by decreasing spread of the centroids so that the early abandon of
+// the tiled kernel discards the wrong clusters on the first bands.
+int predictScene(const DataManager &dataMgr, const string &modelFile, const string &inputFile,
+                 const string &outputFile, int tileSize) {
+    int samples = dataMgr.getSamples(), bands = dataMgr.getBands();
+    int numClusters, i, j;
+    float **model = loadModel(modelFile, numClusters, bands);
+    if (model == nullptr)
+        return 1;
+
+    auto deleteModel = [&] {
+        for (i = 0; i < numClusters; i++)
+            delete[] model[i];
+        delete[] model;
+    };
+
+    ifstream fin(inputFile, std::ios_base::binary);
+    if (!fin) {
+        cout << "Unable to open " << inputFile << " in predictScene." << endl;
+        deleteModel();
+        return 1;
+    }
+    long lineValues = (long) samples * bands, lineBytes = lineValues * (long) sizeof(float);
+    fin.seekg(0, std::ios_base::end);
+    long fileSize = (long) fin.tellg(), numLines = fileSize / lineBytes;
+    fin.seekg(0, std::ios_base::beg);
+    if (fileSize % lineBytes != 0) {
+        cout << "Invalid cube " << inputFile << " in predictScene: " << fileSize << " bytes are not a whole number of "
+             << lineBytes << "-byte lines." << endl;
+        deleteModel();
+        return 1;
+    }
+    ofstream fout(outputFile, std::ios_base::binary);
+    if (!fout) {
+        cout << "Unable to open " << outputFile << " in predictScene." << endl;
+        deleteModel();
+        return 1;
+    }
+
+    // order the bands by decreasing variance of the centroids
+    double *spread = new double[bands];
+    int *bandOrder = new int[bands], *bandPosition = new int[bands];
+    for (j = 0; j < bands; j++) {
+        double sum = 0, sumSq = 0;
+        for (i = 0; i < numClusters; i++) {
+            sum += model[i][j];
+            sumSq += (double) model[i][j] * model[i][j];
+        }
+        spread[j] = sumSq / numClusters - (sum / numClusters) * (sum / numClusters);
+        bandOrder[j] = j;
+    }
+    std::stable_sort(bandOrder, bandOrder + bands, [spread](int a, int b) { return spread[a] > spread[b]; });
+    float **centroids = new float*[numClusters];
+    for (i = 0; i < numClusters; i++) {
+        centroids[i] = new float[bands];
+        for (j = 0; j < bands; j++)
+            centroids[i][j] = model[i][bandOrder[j]];
+    }
+    for (j = 0; j < bands; j++)
+        bandPosition[bandOrder[j]] = j;
+
+    struct Block {
+        long firstLine;
+        int numLines;
+        float *raw;
+        int *labels;
+    };
+    Block slots[PREDICT_SLOTS];
+    BlockingQueue<Block *> freeSlots(PREDICT_SLOTS), readSlots(PREDICT_SLOTS), labelledSlots(PREDICT_SLOTS);
+    for (i = 0; i < PREDICT_SLOTS; i++) {
+        slots[i].raw = new float[PREDICT_BLOCK_LINES * lineValues];
+        slots[i].labels = new int[PREDICT_BLOCK_LINES * samples]();
+        freeSlots.push(&slots[i]);
+    }
+    float *pixels = new float[PREDICT_BLOCK_LINES * lineValues];
+    bool readFailed = false, writeFailed = false;
+
+    printf("Predicting %ld lines with %d clusters..\n", numLines, numClusters); fflush(stdout);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    std::thread reader([&] {
+        Block *block;
+        for (long line = 0; line < numLines && freeSlots.pop(block); line += PREDICT_BLOCK_LINES) {
+            block->firstLine = line;
+            block->numLines = (int) std::min((long) PREDICT_BLOCK_LINES, numLines - line);
+            if (!fin.read((char *) block->raw, block->numLines * lineValues * (long) sizeof(float))) {
+                readFailed = true;
+                break;
+            }
+            readSlots.push(block);
+        }
+        readSlots.close();
+    });
+    std::thread writer([&] {
+        Block *block;
+        while (labelledSlots.pop(block)) {
+            if (!fout.write((const char *) block->labels, (long) block->numLines * samples * (long) sizeof(int)))
+                writeFailed = true;
+            freeSlots.push(block);
+        }
+    });
+
+    Block *block;
+    while (readSlots.pop(block)) {
+        dataMgr.transposeBlock(block->raw, pixels, block->numLines, bandPosition);
+        assignObjectsTiled(pixels, block->labels, block->numLines, samples, centroids, numClusters, bands, tileSize);
+        labelledSlots.push(block);
+    }
+    labelledSlots.close();
+    reader.join();
+    writer.join();
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    double gigabytes = numLines * lineValues * (double) sizeof(float) / 1e9;
+    if (readFailed || writeFailed)
+        cout << "predictScene failed " << (readFailed ? "reading " + inputFile : "writing " + outputFile) << "." << endl;
+    else
+        printf("Labels written to %s in %f seconds, %f GB/s of input\n", outputFile.c_str(), seconds, gigabytes / seconds);
+    fflush(stdout);
+
+    for (i = 0; i < PREDICT_SLOTS; i++) {
+        delete[] slots[i].raw;
+        delete[] slots[i].labels;
+    }
+    for (i = 0; i < numClusters; i++)
+        delete[] centroids[i];
+    deleteModel();
+    delete[] centroids;
+    delete[] pixels;
+    delete[] spread;
+    delete[] bandOrder;
+    delete[] bandPosition;
+    return readFailed || writeFailed ? 1 : 0;
+}
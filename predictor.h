@@ -0,0 +1,20 @@
+#include <iostream>
+#include <string>
+#include "dataManager.h"
+
+#ifndef PREDICTOR_H
+#define PREDICTOR_H
+
+using namespace std;
+
+// Lines of the cube read, labelled and written as a single block by predictScene
+#define PREDICT_BLOCK_LINES 32
+// Blocks in flight between the stages of predictScene
+#define PREDICT_SLOTS 4
+
+int saveModel(const string &fileName, float **centroids, int numClusters, int numBands, const int *bandOrder);
+float **loadModel(const string &fileName, int &numClusters, int numBands);
+int predictScene(const DataManager &dataMgr, const string &modelFile, const string &inputFile,
+                 const string &outputFile, int tileSize);
+
+#endif // PREDICTOR_H